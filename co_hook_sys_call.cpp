@@ -45,6 +45,7 @@ available.
 #include "co_routine_inner.h"
 #include "co_routine_specific.h"
 #include <map>
+#include <type_traits>
 #include <time.h>
 
 typedef long long ll64_t;
@@ -166,32 +167,48 @@ typedef int (*__poll_pfn_t) (struct pollfd fds[], nfds_t nfds, int timeout);
  * 预加载的共享对象中的函数定义（参见ld.so（8）中的LD_PRELOAD）可以找到并调用在另一个共享对象中提供的“真实”函数
  * （或者就此而言，在存在多个预加载层的情况下，函数的“下一个”定义）。
  */
-static socket_pfn_t g_sys_socket_func = (socket_pfn_t) dlsym(RTLD_NEXT, "socket");
-static connect_pfn_t g_sys_connect_func = (connect_pfn_t) dlsym(RTLD_NEXT, "connect");
-static close_pfn_t g_sys_close_func = (close_pfn_t) dlsym(RTLD_NEXT, "close");
+#if defined(__LIBCO_HOOK_WRAP__)
+/**
+ * 链接期替换模式(__LIBCO_HOOK_WRAP__)：不依赖 dlsym(RTLD_NEXT) 和 PLT 抢占，hook 函数编译成 __wrap_read 等，
+ * 链接时加 -Wl,--wrap=read ... 让调用方对 read 的引用落到 __wrap_read，原函数由链接器提供为 __real_read。
+ * g_sys_##name##_func 是编译期常量，调用原函数是直接调用，可以完全静态链接、做 LTO。
+ */
+#define CO_HOOK_NAME(name) __wrap_##name
+#define CO_SYS_FUNC(name)                                                      \
+  extern "C" std::remove_pointer<name##_pfn_t>::type __real_##name, __wrap_##name; \
+  static name##_pfn_t const g_sys_##name##_func = __real_##name
+#else
+#define CO_HOOK_NAME(name) name
+#define CO_SYS_FUNC(name)                                                      \
+  static name##_pfn_t g_sys_##name##_func = (name##_pfn_t) dlsym(RTLD_NEXT, #name)
+#endif
 
-static read_pfn_t g_sys_read_func = (read_pfn_t) dlsym(RTLD_NEXT, "read");
-static write_pfn_t g_sys_write_func = (write_pfn_t) dlsym(RTLD_NEXT, "write");
+CO_SYS_FUNC(socket);
+CO_SYS_FUNC(connect);
+CO_SYS_FUNC(close);
 
-static sendto_pfn_t g_sys_sendto_func = (sendto_pfn_t) dlsym(RTLD_NEXT, "sendto");
-static recvfrom_pfn_t g_sys_recvfrom_func = (recvfrom_pfn_t) dlsym(RTLD_NEXT, "recvfrom");
+CO_SYS_FUNC(read);
+CO_SYS_FUNC(write);
 
-static send_pfn_t g_sys_send_func = (send_pfn_t) dlsym(RTLD_NEXT, "send");
-static recv_pfn_t g_sys_recv_func = (recv_pfn_t) dlsym(RTLD_NEXT, "recv");
+CO_SYS_FUNC(sendto);
+CO_SYS_FUNC(recvfrom);
 
-static poll_pfn_t g_sys_poll_func = (poll_pfn_t) dlsym(RTLD_NEXT, "poll");
+CO_SYS_FUNC(send);
+CO_SYS_FUNC(recv);
 
-static setsockopt_pfn_t g_sys_setsockopt_func = (setsockopt_pfn_t) dlsym(RTLD_NEXT, "setsockopt");
-static fcntl_pfn_t g_sys_fcntl_func = (fcntl_pfn_t) dlsym(RTLD_NEXT, "fcntl");
+CO_SYS_FUNC(poll);
 
-static setenv_pfn_t g_sys_setenv_func = (setenv_pfn_t) dlsym(RTLD_NEXT, "setenv");
-static unsetenv_pfn_t g_sys_unsetenv_func = (unsetenv_pfn_t) dlsym(RTLD_NEXT, "unsetenv");
-static getenv_pfn_t g_sys_getenv_func = (getenv_pfn_t) dlsym(RTLD_NEXT, "getenv");
-static __res_state_pfn_t g_sys___res_state_func = (__res_state_pfn_t) dlsym(RTLD_NEXT, "__res_state");
+CO_SYS_FUNC(setsockopt);
+CO_SYS_FUNC(fcntl);
 
-static gethostbyname_pfn_t g_sys_gethostbyname_func = (gethostbyname_pfn_t) dlsym(RTLD_NEXT, "gethostbyname");
+CO_SYS_FUNC(setenv);
+CO_SYS_FUNC(unsetenv);
+CO_SYS_FUNC(getenv);
+CO_SYS_FUNC(__res_state);
 
-static __poll_pfn_t g_sys___poll_func = (__poll_pfn_t) dlsym(RTLD_NEXT, "__poll");
+CO_SYS_FUNC(gethostbyname);
+
+CO_SYS_FUNC(__poll);
 
 /*
 static pthread_getspecific_pfn_t g_sys_pthread_getspecific_func
@@ -215,11 +232,13 @@ static pthread_rwlock_unlock_pfn_t g_sys_pthread_rwlock_unlock_func
 (pthread_rwlock_unlock_pfn_t)dlsym(RTLD_NEXT,"pthread_rwlock_unlock");
 */
 
+#if defined(__i386__) || defined(__x86_64__)
 static inline unsigned long long get_tick_count() { // 该函数未被使用
   uint32_t lo, hi;
   __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi));
   return ((unsigned long long) lo) | (((unsigned long long) hi) << 32);
 }
+#endif
 
 struct rpchook_connagent_head_t { // 未使用该结构
   unsigned char bVersion;
@@ -234,10 +253,14 @@ struct rpchook_connagent_head_t { // 未使用该结构
 /** 
  * hook系统调用 - 将动态库中名为name的系统调用地址(即函数指针)绑定到以g_sys_##name##__func命名的函数指针 
  */
+#if defined(__LIBCO_HOOK_WRAP__)
+#define HOOK_SYS_FUNC(name)
+#else
 #define HOOK_SYS_FUNC(name)                                                    \
   if (!g_sys_##name##_func) {                                                  \
     g_sys_##name##_func = (name##_pfn_t)dlsym(RTLD_NEXT, #name);               \
   }
+#endif
 
 /**
  * diff_ms - 计算以毫秒为单位的时间差
@@ -305,12 +328,12 @@ static inline void free_by_fd(int fd) {
  * socket - 被hook后的socket函数, 主要是为套接字fd分配对应的 rpchook_t 类型的内存空间, 并往 g_rpchook_socket_fd 
  * 中添加该内存空间的地址(指针指向的变量未全部初始化) 
  */
-int socket(int domain, int type, int protocol) {
+int CO_HOOK_NAME(socket)(int domain, int type, int protocol) {
   // 重命名动态库中的socket系统调用
   HOOK_SYS_FUNC(socket);
 
   // 协程禁止hook系统调用, 则直接调用socket系统调用返回socket文件描述符fd
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_socket_func(domain, type, protocol);
   }
 
@@ -345,10 +368,10 @@ int co_accept(int fd, struct sockaddr* addr, socklen_t* len) {
 /** 
  * connect - 被hook后的connect函数, 主要是初始化(g_rpchook_socket_fd中)套接字fd对应的rpchook_t类型变量的dest成员
  */
-int connect(int fd, const struct sockaddr* address, socklen_t address_len) {
+int CO_HOOK_NAME(connect)(int fd, const struct sockaddr* address, socklen_t address_len) {
   HOOK_SYS_FUNC(connect);
 
-  if (!co_is_enable_sys_hook()) { // 没有开启系统api hook机制
+  if (!co_is_enable_sys_hook_fast()) { // 没有开启系统api hook机制
     return g_sys_connect_func(fd, address, address_len);
   }
 
@@ -378,7 +401,7 @@ int connect(int fd, const struct sockaddr* address, socklen_t address_len) {
     pf.fd = fd; // 需要轮询的文件描述符
     // 等待发生的事件：写数据不会导致阻塞 | 指定的文件描述符发生错误 | 指定的文件描述符挂起事件
     pf.events = (POLLOUT | POLLERR | POLLHUP); 
-    pollret = poll(&pf, 1, 25000); // 监听该fd的各个事件，超时时25s
+    pollret = CO_HOOK_NAME(poll)(&pf, 1, 25000); // 监听该fd的各个事件，超时时25s
     if (pollret == 1) { // 返回值为1表示该fd已经有事件发生了
       break;
     }
@@ -426,11 +449,11 @@ int connect(int fd, const struct sockaddr* address, socklen_t address_len) {
  * close - 被hook后的close函数, 主要是释放(g_rpchook_socket_fd中)
  * 套接字fd对应的rpchook_t类型存储空间 
  */
-int close(int fd) {
+int CO_HOOK_NAME(close)(int fd) {
   HOOK_SYS_FUNC(close);
 
   // 协程禁止hook系统调用, 则直接调用系统调用
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_close_func(fd);
   }
 
@@ -444,11 +467,11 @@ int close(int fd) {
 /**
  * read - 被hook后的read函数, 主要是向内核注册套接字fd上的事件 
  */
-ssize_t read(int fd, void* buf, size_t nbyte) {
+ssize_t CO_HOOK_NAME(read)(int fd, void* buf, size_t nbyte) {
   HOOK_SYS_FUNC(read);
 
   // 协程禁止hook系统调用, 则直接调用系统原生read()
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_read_func(fd, buf, nbyte);
   }
 
@@ -468,7 +491,7 @@ ssize_t read(int fd, void* buf, size_t nbyte) {
   pf.fd = fd;
   // 等待发生的事件：有数据可读 | 指定的文件描述符发生错误 | 指定的文件描述符挂起事件
   pf.events = (POLLIN | POLLERR | POLLHUP);
-  int pollret = poll(&pf, 1, timeout);
+  int pollret = CO_HOOK_NAME(poll)(&pf, 1, timeout);
 
   ssize_t readret = g_sys_read_func(fd, (char*) buf, nbyte); // 调用系统原始read()
 
@@ -483,11 +506,11 @@ ssize_t read(int fd, void* buf, size_t nbyte) {
 /**
  * write - 被hook后的write函数, 主要是向内核注册套接字fd上的事件
  */
-ssize_t write(int fd, const void* buf, size_t nbyte) {
+ssize_t CO_HOOK_NAME(write)(int fd, const void* buf, size_t nbyte) {
   HOOK_SYS_FUNC(write);
 
   // 协程禁止hook系统调用, 则直接调用系统调用
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_write_func(fd, buf, nbyte);
   }
 
@@ -518,7 +541,7 @@ ssize_t write(int fd, const void* buf, size_t nbyte) {
     pf.fd = fd;
     // 
     pf.events = (POLLOUT | POLLERR | POLLHUP);
-    poll(&pf, 1, timeout);
+    CO_HOOK_NAME(poll)(&pf, 1, timeout);
 
     writeret = g_sys_write_func(fd, (const char*) buf + wrotelen, nbyte - wrotelen);
 
@@ -536,7 +559,7 @@ ssize_t write(int fd, const void* buf, size_t nbyte) {
 /**
  * sendto - 被hook后的sendto函数, 主要是向内核注册套接字fd上的事件
  */
-ssize_t sendto(int socket, const void* message, size_t length, int flags,
+ssize_t CO_HOOK_NAME(sendto)(int socket, const void* message, size_t length, int flags,
                const struct sockaddr* dest_addr, socklen_t dest_len) {
   /**
    * 1.no enable sys call ? sys
@@ -547,7 +570,7 @@ ssize_t sendto(int socket, const void* message, size_t length, int flags,
    */
   HOOK_SYS_FUNC(sendto);
 
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_sendto_func(socket, message, length, flags, dest_addr, dest_len);
   }
 
@@ -563,7 +586,7 @@ ssize_t sendto(int socket, const void* message, size_t length, int flags,
     struct pollfd pf = {0};
     pf.fd = socket;
     pf.events = (POLLOUT | POLLERR | POLLHUP);
-    poll(&pf, 1, timeout);
+    CO_HOOK_NAME(poll)(&pf, 1, timeout);
 
     ret = g_sys_sendto_func(socket, message, length, flags, dest_addr, dest_len);
   }
@@ -573,11 +596,11 @@ ssize_t sendto(int socket, const void* message, size_t length, int flags,
 /**
  * recvfrom - 被hook后的recvfrom函数, 主要是向内核注册套接字fd上的事件
  */
-ssize_t recvfrom(int socket, void* buffer, size_t length, int flags,
+ssize_t CO_HOOK_NAME(recvfrom)(int socket, void* buffer, size_t length, int flags,
                  struct sockaddr* address, socklen_t* address_len) {
 
   HOOK_SYS_FUNC(recvfrom);
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_recvfrom_func(socket, buffer, length, flags, address, address_len);
   }
 
@@ -591,7 +614,7 @@ ssize_t recvfrom(int socket, void* buffer, size_t length, int flags,
   struct pollfd pf = {0};
   pf.fd = socket;
   pf.events = (POLLIN | POLLERR | POLLHUP);
-  poll(&pf, 1, timeout);
+  CO_HOOK_NAME(poll)(&pf, 1, timeout);
 
   ssize_t ret = g_sys_recvfrom_func(socket, buffer, length, flags, address, address_len);
   return ret;
@@ -600,10 +623,10 @@ ssize_t recvfrom(int socket, void* buffer, size_t length, int flags,
 /**
  * send - 被hook后的send函数, 主要是向内核注册套接字fd上的事件
  */
-ssize_t send(int socket, const void* buffer, size_t length, int flags) {
+ssize_t CO_HOOK_NAME(send)(int socket, const void* buffer, size_t length, int flags) {
   HOOK_SYS_FUNC(send);
 
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_send_func(socket, buffer, length, flags);
   }
   rpchook_t* lp = get_by_fd(socket);
@@ -626,7 +649,7 @@ ssize_t send(int socket, const void* buffer, size_t length, int flags) {
     struct pollfd pf = {0};
     pf.fd = socket;
     pf.events = (POLLOUT | POLLERR | POLLHUP);
-    poll(&pf, 1, timeout);
+    CO_HOOK_NAME(poll)(&pf, 1, timeout);
 
     writeret = g_sys_send_func(socket, (const char *)buffer + wrotelen, length - wrotelen, flags);
 
@@ -644,10 +667,10 @@ ssize_t send(int socket, const void* buffer, size_t length, int flags) {
 /**
  * recv - 被hook后的recv函数, 主要是向内核注册套接字fd上的事件
  */
-ssize_t recv(int socket, void* buffer, size_t length, int flags) {
+ssize_t CO_HOOK_NAME(recv)(int socket, void* buffer, size_t length, int flags) {
   HOOK_SYS_FUNC(recv);
 
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_recv_func(socket, buffer, length, flags);
   }
   rpchook_t* lp = get_by_fd(socket);
@@ -661,7 +684,7 @@ ssize_t recv(int socket, void* buffer, size_t length, int flags) {
   pf.fd = socket;
   pf.events = (POLLIN | POLLERR | POLLHUP);
 
-  int pollret = poll(&pf, 1, timeout);
+  int pollret = CO_HOOK_NAME(poll)(&pf, 1, timeout);
 
   ssize_t readret = g_sys_recv_func(socket, buffer, length, flags);
 
@@ -695,10 +718,10 @@ extern int co_poll_inner(stCoEpoll_t* ctx,
  * timeout为0指示poll调用立即返回并列出准备好I/O的文件描述符，但并不等待其它的事件。
  * 这种情况下，poll()就像它的名字那样，一旦选举出来，立即返回
  */
-int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
+int CO_HOOK_NAME(poll)(struct pollfd fds[], nfds_t nfds, int timeout) {
   HOOK_SYS_FUNC(poll);
 
-  if (!co_is_enable_sys_hook() || timeout == 0) {
+  if (!co_is_enable_sys_hook_fast() || timeout == 0) {
     return g_sys_poll_func(fds, nfds, timeout);
   }
 
@@ -745,10 +768,10 @@ int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
  * setsockopt - 被hook后的setsockopt函数, 主要是初始化(g_rpchook_socket_fd中)套接字fd
  * 对应的rpchook_t类型变量的read_timeout和write_timeout成员
  */
-int setsockopt(int fd, int level, int option_name, const void* option_value, socklen_t option_len) {
+int CO_HOOK_NAME(setsockopt)(int fd, int level, int option_name, const void* option_value, socklen_t option_len) {
   HOOK_SYS_FUNC(setsockopt);
 
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_setsockopt_func(fd, level, option_name, option_value, option_len);
   }
   rpchook_t* lp = get_by_fd(fd);
@@ -767,7 +790,7 @@ int setsockopt(int fd, int level, int option_name, const void* option_value, soc
 /** 
  * fcntl - 被hook后的fcntl函数, 主要是初始化(g_rpchook_socket_fd中)套接字fd对应的rpchook_t类型变量的user_flag成员
  */
-int fcntl(int fildes, int cmd, ...) {
+int CO_HOOK_NAME(fcntl)(int fildes, int cmd, ...) {
   HOOK_SYS_FUNC(fcntl);
 
   if (fildes < 0) {
@@ -809,7 +832,7 @@ int fcntl(int fildes, int cmd, ...) {
   case F_SETFL: {
     int param = va_arg(arg_list, int);
     int flag = param;
-    if (co_is_enable_sys_hook() && lp) {
+    if (co_is_enable_sys_hook_fast() && lp) {
       flag |= O_NONBLOCK; // 非阻塞
     }
     ret = g_sys_fcntl_func(fildes, cmd, flag); // 这里设置文件描述符(fd)为 NONBLOCK
@@ -919,11 +942,11 @@ void co_set_env_list(const char* name[], size_t cnt) {
   }
 }
 
-int setenv(const char* n, const char* value, int overwrite) {
+int CO_HOOK_NAME(setenv)(const char* n, const char* value, int overwrite) {
   HOOK_SYS_FUNC(setenv)
 
-  if (co_is_enable_sys_hook() && g_co_sysenv.data) {
-    stCoRoutine_t* self = co_self(); // 获取当前正在运行的协程实例
+  if (co_is_enable_sys_hook_fast() && g_co_sysenv.data) {
+    stCoRoutine_t* self = co_self_fast(); // 获取当前正在运行的协程实例
     if (self) {
       if (!self->pvEnv) {
         self->pvEnv = dup_co_sysenv_arr(&g_co_sysenv);
@@ -948,11 +971,11 @@ int setenv(const char* n, const char* value, int overwrite) {
   return g_sys_setenv_func(n, value, overwrite);
 }
 
-int unsetenv(const char* n) {
+int CO_HOOK_NAME(unsetenv)(const char* n) {
   HOOK_SYS_FUNC(unsetenv)
 
-  if (co_is_enable_sys_hook() && g_co_sysenv.data) {
-    stCoRoutine_t* self = co_self();
+  if (co_is_enable_sys_hook_fast() && g_co_sysenv.data) {
+    stCoRoutine_t* self = co_self_fast();
     if (self) {
       if (!self->pvEnv) {
         self->pvEnv = dup_co_sysenv_arr(&g_co_sysenv);
@@ -975,11 +998,11 @@ int unsetenv(const char* n) {
   return g_sys_unsetenv_func(n);
 }
 
-char* getenv(const char* n) {
+char* CO_HOOK_NAME(getenv)(const char* n) {
   HOOK_SYS_FUNC(getenv)
 
-  if (co_is_enable_sys_hook() && g_co_sysenv.data) {
-    stCoRoutine_t* self = co_self();
+  if (co_is_enable_sys_hook_fast() && g_co_sysenv.data) {
+    stCoRoutine_t* self = co_self_fast();
 
     stCoSysEnv_t name = {(char*) n, 0};
 
@@ -1002,13 +1025,13 @@ struct hostent* co_gethostbyname(const char* name);
 /**
  * 通过域名获取ip地址
  */
-struct hostent* gethostbyname(const char* name) {
+struct hostent* CO_HOOK_NAME(gethostbyname)(const char* name) {
   HOOK_SYS_FUNC(gethostbyname);
 
 #if defined(__APPLE__) || defined(__FreeBSD__)
   return g_sys_gethostbyname_func(name);
 #else
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys_gethostbyname_func(name);
   }
   return co_gethostbyname(name);
@@ -1054,17 +1077,17 @@ CO_ROUTINE_SPECIFIC(res_state_wrap, __co_state_wrap);
 
 extern "C" {
 
-res_state __res_state() {
+res_state CO_HOOK_NAME(__res_state)() {
   HOOK_SYS_FUNC(__res_state);
   
-  if (!co_is_enable_sys_hook()) {
+  if (!co_is_enable_sys_hook_fast()) {
     return g_sys___res_state_func();
   }
   return &(__co_state_wrap->state);
 }
 
-int __poll(struct pollfd fds[], nfds_t nfds, int timeout) {
-  return poll(fds, nfds, timeout);
+int CO_HOOK_NAME(__poll)(struct pollfd fds[], nfds_t nfds, int timeout) {
+  return CO_HOOK_NAME(poll)(fds, nfds, timeout);
 }
 
 }
@@ -1128,5 +1151,6 @@ void co_enable_hook_sys() { // 这函数必须写在这里,否则本文件会被
   stCoRoutine_t* co = GetCurrThreadCo();
   if (co) {
     co->cEnableSysHook = 1;
+    co_set_curr_word(co);
   }
 }
@@ -21,14 +21,19 @@ available.
 #include "co_epoll.h"
 #include "co_routine_inner.h"
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 
+#include <dlfcn.h>
+#include <malloc.h>
 #include <errno.h>
 #include <poll.h>
+#include <signal.h>
 #include <sys/time.h>
 
 #include <assert.h>
@@ -38,6 +43,10 @@ available.
 #include <limits.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <linux/falloc.h>
+#endif
 #include <sys/syscall.h>
 #include <unistd.h>
 
@@ -64,6 +73,102 @@ using namespace std;
 stCoRoutine_t* GetCurrCo(stCoRoutineEnv_t* env);
 struct stCoEpoll_t;
 
+/**
+ * 栈回收池的一个桶：同一个(栈大小, 分配方式)的空闲栈组成单链表
+ */
+struct stCoStackBucket_t {
+  int stack_size;
+  int flags;
+  int count;
+  stStackMem_t* free_list;
+};
+
+/**
+ * 每个线程的独享栈回收池，见 co_set_stack_pool()
+ * 一个进程里用到的栈大小通常只有一两种，所以桶是定长数组，线性查找
+ */
+struct stCoStackPool_t {
+  size_t high_watermark;
+  size_t low_watermark;
+  int lazy_alloc;
+  size_t cached_bytes;
+  static const int kBucketCount = 8;
+  stCoStackBucket_t buckets[kBucketCount];
+};
+
+/**
+ * 共享栈 save_buffer 的按大小分级的回收池：第 i 级的块大小为 kMinSize << i，空闲块的头部存放下一块的指针
+ * 超过最大一级的直接 malloc/free；每一级最多缓存 kClassBytes 字节(至少 kMinCount 块)
+ */
+struct stCoSaveBufPool_t {
+  static const int kMinShift = 9; // 512B
+  static const int kClassCount = 12; // 512B ~ 1M
+  static const size_t kClassBytes = 1024 * 1024;
+  static const int kMinCount = 4;
+  void* free_list[kClassCount];
+  int count[kClassCount];
+};
+
+/**
+ * co_arena_alloc 的一块内存，头部之后是数据。一个协程用到的块用 next 串起来，链表头是正在分配的块。
+ * 标准大小的块用完后回到线程的空闲链表(最多 kMaxCached 块)，放不进标准块的请求单独分配一块，用完直接 free
+ */
+struct stCoArenaChunk_t {
+  stCoArenaChunk_t* next;
+  size_t size; // 数据区大小
+  size_t used;
+};
+
+struct stCoArenaPool_t {
+  static const size_t kChunkSize = 32 * 1024; // 含头部
+  static const int kMaxCached = 32;
+  stCoArenaChunk_t* free_list;
+  int count;
+};
+
+/**
+ * 栈使用深度按协程函数汇总的一条，见 co_set_stack_profile()
+ */
+struct stCoStackProfileEntry_t {
+  pfn_co_routine_t pfn;
+  unsigned long long samples;
+  unsigned long long total_used;
+  unsigned int stack_size;
+  unsigned int max_used;
+};
+
+/**
+ * 协程函数的种类一般不多，定长数组线性查找，满了之后新的 pfn 不再统计
+ */
+struct stCoStackProfileTable_t {
+  static const int kMaxEntries = 64;
+  int enable;
+  int count;
+  stCoStackProfileEntry_t entries[kMaxEntries];
+};
+
+/**
+ * 休眠 slab：按 kChunkSize 分块顺序追加(不带 malloc 头)，每块记录还活着的字节数，
+ * 减到 0 时整块释放(正在追加的块则从头复用)；超过 kChunkSize / 4 的内容单独占一块
+ */
+struct stCoHibChunk_t {
+  stCoHibChunk_t* pPrev;
+  stCoHibChunk_t* pNext;
+  unsigned int size;
+  unsigned int used;
+  unsigned int live;
+};
+
+struct stCoHibSlab_t {
+  static const unsigned int kChunkSize = 64 * 1024;
+
+  stCoHibChunk_t* chunks;
+  stCoHibChunk_t* curr; // 正在追加的块
+  unsigned char* scratch; // 压缩的输出缓冲
+  unsigned int scratch_cap;
+  unsigned int* lz_table; // 压缩用的哈希表
+};
+
 /**
  * 协程环境类型 - 每个线程有且仅有一个该类型的变量 【相当于当前线程的调度器 marked by habbyge】
  *
@@ -93,6 +198,36 @@ struct stCoRoutineEnv_t {
   // for copy stack log lastco and nextco
   stCoRoutine_t* pending_co; // 挂起的协程，也是下一个将要执行的协程
   stCoRoutine_t* occupy_co;  // 当前协程(占据)
+
+  stCoStackPool_t stack_pool; // 独享栈回收池
+  stCoSaveBufPool_t save_buf_pool; // 共享栈 save_buffer 回收池
+  stCoArenaPool_t arena_pool; // co_arena_alloc 的空闲块
+  stCoSlab_t poll_slab; // co_poll_inner 的 stPollBlock_t
+  stCoSlab_t cond_slab; // co_cond_timedwait 的 stCoCondItem_t
+  unsigned long long share_swap_seq; // 切换到共享栈协程的次数，作为 stStackMem_t::last_swap 的时钟
+
+  stCoRoutine_t* pCoList; // 本线程所有协程
+  unsigned int idle_trim_ms; // 见 co_set_idle_trim()
+  int idle_trim_advice;
+  unsigned long long idle_trim_last; // 上次扫描的时间(ms)
+
+  stCoStackProfileTable_t* stack_profile; // 打开 co_set_stack_profile 后才分配
+
+  unsigned long long promote_bytes; // 见 co_set_share_promotion()
+  unsigned int promote_window;
+
+  stCoHibSlab_t hib_slab; // 休眠协程的栈内容，见 co_hibernate()
+  unsigned int hibernate_ms;
+  int hibernate_flags;
+  unsigned long long hibernate_last;
+
+  int numa_local; // 见 co_set_numa_local()
+  stCoRoutine_t* numa_obj_free; // NUMA 本地对象块里空闲的 stCoRoutine_t
+
+  stCoRoutine_t* reuse_list; // co_release 停下来待复用的协程，用 pNextCo 串起来，见 co_set_reuse_pool()
+  unsigned int reuse_count;
+  unsigned int reuse_max;
+  stCoStat_t stat;
 };
 
 // int socket(int domain, int type, int protocol);
@@ -269,47 +404,600 @@ void inline Join(TLink* apLink, TLink* apOther) {
 }
 
 /////////////////for copy stack //////////////////////////
+// 编译时定义 __LIBCO_MMAP_STACK__ 则所有协程栈(包括共享栈)默认用 mmap 分配
+#if defined(__LIBCO_MMAP_STACK__)
+static const int kCoDefaultStackFlags = CO_STACK_MMAP;
+#else
+static const int kCoDefaultStackFlags = 0;
+#endif
+
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static size_t co_page_size() {
+  static size_t page_size = 0;
+  if (!page_size) {
+    page_size = sysconf(_SC_PAGESIZE);
+  }
+  return page_size;
+}
+
+#if defined(__linux__) && !defined(MPOL_PREFERRED)
+#define MPOL_PREFERRED 1
+#endif
+
+/**
+ * 调用线程当前所在的 NUMA 节点，取不到时返回 -1
+ */
+static int co_numa_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned int cpu = 0;
+  unsigned int node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+    return node;
+  }
+#endif
+  return -1;
+}
+
+/**
+ * 之后在 [addr, addr + len) 上缺页时优先从 node 分配(MPOL_PREFERRED，节点内存不够时退到别的节点而不是 OOM)，
+ * 已经分配的页不迁移。addr 要按页对齐
+ */
+static bool co_numa_bind(void* addr, size_t len, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (node < 0 || node >= (int) sizeof(unsigned long) * 8) {
+    return false;
+  }
+  unsigned long mask = 1UL << node;
+  if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0) == 0) {
+    return true;
+  }
+  co_log_err("CO_ERR: mbind node %d errno %d", node, errno);
+#endif
+  return false;
+}
+
+/**
+ * 逐页写一次，让页在当前线程的节点上分配出来(不论之后谁先碰到)
+ */
+static void co_numa_prefault(char* addr, size_t len) {
+  size_t page = co_page_size();
+  for (size_t off = 0; off < len; off += page) {
+    *(volatile char*) (addr + off) = 0;
+  }
+}
+
+/**
+ * mmap 一块栈：[保护页(PROT_NONE)][stack_size]，MAP_NORESERVE 不预占交换空间，物理页按需提交
+ * @return stack_buffer(保护页之上)，失败返回 NULL
+ */
+static char* co_mmap_stack(unsigned int stack_size) {
+  size_t guard = co_page_size();
+  char* addr = (char*) mmap(NULL, guard + stack_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+  if (mprotect(addr, guard, PROT_NONE) != 0) {
+    munmap(addr, guard + stack_size);
+    return NULL;
+  }
+  return addr + guard;
+}
+
+/**
+ * CO_STACK_GROWABLE：初始提交的大小，以及每次缺页至少向下扩展的大小
+ */
+static const size_t kCoGrowInitial = 8 * 1024;
+static const size_t kCoGrowStep = 16 * 1024;
+
+/**
+ * 可增长的栈：[保护页][stack_size]整段先映射为 PROT_NONE，只把栈顶 kCoGrowInitial 改成可读写
+ */
+static char* co_mmap_growable_stack(unsigned int stack_size, char** commit_low) {
+  size_t guard = co_page_size();
+  char* addr = (char*) mmap(NULL, guard + stack_size, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+  size_t commit = stack_size < kCoGrowInitial ? stack_size : kCoGrowInitial;
+  char* bp = addr + guard + stack_size;
+  if (mprotect(bp - commit, commit, PROT_READ | PROT_WRITE) != 0) {
+    munmap(addr, guard + stack_size);
+    return NULL;
+  }
+  *commit_low = bp - commit;
+  return addr + guard;
+}
+
+static struct sigaction gCoOldSegvAction;
+static const char kCoOverflowMsg[] = "libco: coroutine stack overflow\n";
+static const size_t kCoOverflowSlack = 64 * 1024;
+
+/**
+ * 缺页地址落在 stack_mem 未提交的部分时扩展，返回 true 表示已处理
+ */
+static bool co_grow_stack(stStackMem_t* stack_mem, char* addr) {
+  if (!stack_mem || !(stack_mem->alloc_flags & CO_STACK_GROWABLE)) {
+    return false;
+  }
+  size_t page = co_page_size();
+  // 碰到了上限下面的保护页；大的栈帧可能直接越过保护页，所以栈底下方 kCoOverflowSlack 以内都算溢出
+  if (addr >= stack_mem->stack_buffer - kCoOverflowSlack && addr < stack_mem->stack_buffer) {
+    ssize_t ret = write(2, kCoOverflowMsg, sizeof(kCoOverflowMsg) - 1);
+    (void) ret;
+    return false;
+  }
+  if (addr < stack_mem->stack_buffer || addr >= stack_mem->commit_low) {
+    return false;
+  }
+
+  char* low = (char*) ((uintptr_t) addr & ~(page - 1));
+  if ((size_t) (stack_mem->commit_low - low) < kCoGrowStep) {
+    low = stack_mem->commit_low - kCoGrowStep;
+  }
+  if (low < stack_mem->stack_buffer) {
+    low = stack_mem->stack_buffer;
+  }
+  if (mprotect(low, stack_mem->commit_low - low, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (env) {
+    env->stat.stack_grow_count++;
+    env->stat.stack_grow_bytes += stack_mem->commit_low - low;
+  }
+  stack_mem->commit_low = low;
+  return true;
+}
+
+/**
+ * SIGSEGV 处理函数，运行在 sigaltstack 上(协程栈此时已经不能用了)。
+ * 缺页的一般是当前协程的栈；co_swap 在切换前就更新了当前协程，这时还在旧协程的栈上跑 save_stack_buffer，
+ * 所以再查一遍调用链上的其他协程
+ */
+static void co_segv_handler(int sig, siginfo_t* info, void* uctx) {
+  char* addr = (char*) info->si_addr;
+  stCoRoutine_t* co = co_self_fast();
+  if (co && co_grow_stack(co->stack_mem, addr)) {
+    return;
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  for (int i = env ? env->iCallStackSize - 1 : -1; i >= 0; i--) {
+    if (env->pCallStack[i] != co && co_grow_stack(env->pCallStack[i]->stack_mem, addr)) {
+      return;
+    }
+  }
+
+  // 不是可增长栈的缺页：交给原来的处理函数；没有的话恢复默认处理，返回后重新执行出错的指令，按默认方式崩溃
+  if (gCoOldSegvAction.sa_flags & SA_SIGINFO) {
+    gCoOldSegvAction.sa_sigaction(sig, info, uctx);
+  } else if (gCoOldSegvAction.sa_handler != SIG_DFL && gCoOldSegvAction.sa_handler != SIG_IGN) {
+    gCoOldSegvAction.sa_handler(sig);
+  } else {
+    signal(SIGSEGV, SIG_DFL);
+  }
+}
+
+static void co_install_segv_handler() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = co_segv_handler;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, &gCoOldSegvAction);
+}
+
+/**
+ * 第一次分配可增长栈时：进程内安装一次 SIGSEGV 处理函数，当前线程没有 sigaltstack 的话分配一个
+ */
+static void co_growable_setup() {
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  static __thread bool altstack_ready = false;
+  co_page_size(); // 处理函数里要用，先初始化
+  pthread_once(&once, co_install_segv_handler);
+  if (altstack_ready) {
+    return;
+  }
+  altstack_ready = true;
+
+  stack_t old;
+  if (sigaltstack(NULL, &old) == 0 && !(old.ss_flags & SS_DISABLE)) {
+    return;
+  }
+  stack_t ss;
+  ss.ss_size = 64 * 1024;
+  ss.ss_sp = mmap(NULL, ss.ss_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ss.ss_flags = 0;
+  if (ss.ss_sp == MAP_FAILED || sigaltstack(&ss, NULL) != 0) {
+    co_log_err("CO_ERR: co_growable_setup sigaltstack errno %d", errno);
+  }
+}
+
+/**
+ * 回收池分桶用的分配方式：只看 CO_STACK_MMAP/GROWABLE/NUMA，GROWABLE 和 NUMA 隐含 MMAP
+ */
+static int co_stack_pool_key(int flags) {
+  flags = (flags | kCoDefaultStackFlags) & (CO_STACK_MMAP | CO_STACK_GROWABLE | CO_STACK_NUMA);
+  if (flags & (CO_STACK_GROWABLE | CO_STACK_NUMA)) {
+    flags |= CO_STACK_MMAP;
+  }
+  return flags;
+}
+
 /**
  * 为协程创建一个栈
  * @param stack_size 栈大小
+ * @param flags      CO_STACK_*，mmap 失败时退回 malloc
  */
-stStackMem_t* co_alloc_stackmem(unsigned int stack_size) {
-  stStackMem_t* stack_mem = (stStackMem_t*) malloc(sizeof(stStackMem_t));
+stStackMem_t* co_alloc_stackmem(unsigned int stack_size, int flags) {
+  stStackMem_t* stack_mem = (stStackMem_t*) calloc(1, sizeof(stStackMem_t));
   stack_mem->occupy_co = NULL;
   stack_mem->stack_size = stack_size;
-  stack_mem->stack_buffer = (char*) malloc(stack_size);
+  stack_mem->stack_buffer = NULL;
+  stack_mem->alloc_flags = 0;
+  stack_mem->pool_key = co_stack_pool_key(flags);
+  stack_mem->numa_node = -1;
+  if (flags & CO_STACK_NUMA) { // mbind 要求按页对齐
+    flags |= CO_STACK_MMAP;
+  }
+  if (flags & CO_STACK_GROWABLE) {
+    co_growable_setup();
+    stack_mem->stack_buffer = co_mmap_growable_stack(stack_size, &stack_mem->commit_low);
+    if (stack_mem->stack_buffer) {
+      stack_mem->alloc_flags |= CO_STACK_MMAP | CO_STACK_GROWABLE;
+    } else {
+      co_log_err("CO_ERR: co_alloc_stackmem growable %u failed errno %d", stack_size, errno);
+    }
+  }
+  if (!stack_mem->stack_buffer && ((flags | kCoDefaultStackFlags) & CO_STACK_MMAP)) {
+    stack_mem->stack_buffer = co_mmap_stack(stack_size);
+    if (stack_mem->stack_buffer) {
+      stack_mem->alloc_flags |= CO_STACK_MMAP;
+    } else {
+      co_log_err("CO_ERR: co_alloc_stackmem mmap %u failed errno %d, fallback to malloc", stack_size, errno);
+    }
+  }
+  if (!stack_mem->stack_buffer) {
+    stack_mem->stack_buffer = (char*) malloc(stack_size);
+  }
   stack_mem->stack_bp = stack_mem->stack_buffer + stack_size;
+  if ((flags & CO_STACK_NUMA) && (stack_mem->alloc_flags & CO_STACK_MMAP)) {
+    int node = co_numa_node();
+    if (co_numa_bind(stack_mem->stack_buffer, stack_size, node)) {
+      stack_mem->alloc_flags |= CO_STACK_NUMA;
+      stack_mem->numa_node = node;
+    }
+  }
   return stack_mem;
 }
 
+void co_free_stackmem(stStackMem_t* stack_mem) {
+  if (stack_mem->alloc_flags & CO_STACK_HUGEPAGE) {
+    // 大页 arena 里切出来的共享栈(被提升为独享栈后才会走到这里)，arena 不单独释放
+  } else if (stack_mem->alloc_flags & CO_STACK_MMAP) {
+    size_t guard = co_page_size();
+    munmap(stack_mem->stack_buffer - guard, guard + stack_mem->stack_size);
+  } else {
+    free(stack_mem->stack_buffer);
+  }
+  if (stack_mem->alloc_flags & CO_STACK_REMAP) {
+    close(stack_mem->remap_fd);
+    free(stack_mem->remap_free);
+  }
+  free(stack_mem);
+}
+
+/**
+ * 回收池里(栈大小, 分配方式)对应的桶，没有返回 NULL
+ */
+static stCoStackBucket_t* co_find_stack_bucket(stCoStackPool_t* pool, int stack_size, int flags) {
+  for (int i = 0; i < stCoStackPool_t::kBucketCount; i++) {
+    stCoStackBucket_t* bucket = &pool->buckets[i];
+    if (bucket->stack_size == stack_size && bucket->flags == flags) {
+      return bucket;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * 从当前线程的回收池取一块独享栈，没有则新分配
+ */
+static stStackMem_t* co_stack_pool_get(stCoRoutineEnv_t* env, int stack_size, int flags) {
+  stCoStackPool_t* pool = &env->stack_pool;
+  flags = co_stack_pool_key(flags | (env->numa_local ? CO_STACK_NUMA : 0));
+
+  stCoStackBucket_t* bucket = pool->cached_bytes ? co_find_stack_bucket(pool, stack_size, flags) : NULL;
+  if (bucket && bucket->free_list) {
+    stStackMem_t* stack_mem = bucket->free_list;
+    bucket->free_list = stack_mem->pNext;
+    bucket->count--;
+    pool->cached_bytes -= stack_size;
+    stack_mem->pNext = NULL;
+    env->stat.stack_pool_hit++;
+    return stack_mem;
+  }
+  env->stat.stack_pool_miss++;
+  return co_alloc_stackmem(stack_size, flags);
+}
+
+/**
+ * 把缓存降到 low_watermark 以下
+ */
+static void co_stack_pool_trim(stCoRoutineEnv_t* env, size_t low_watermark) {
+  stCoStackPool_t* pool = &env->stack_pool;
+  for (int i = 0; i < stCoStackPool_t::kBucketCount && pool->cached_bytes > low_watermark; i++) {
+    stCoStackBucket_t* bucket = &pool->buckets[i];
+    while (bucket->free_list && pool->cached_bytes > low_watermark) {
+      stStackMem_t* stack_mem = bucket->free_list;
+      bucket->free_list = stack_mem->pNext;
+      bucket->count--;
+      pool->cached_bytes -= stack_mem->stack_size;
+      co_free_stackmem(stack_mem);
+      env->stat.stack_pool_free++;
+    }
+  }
+}
+
+/**
+ * 归还一块独享栈：按申请时的分配方式放进对应的桶(没有则占一个空桶)，超过 high_watermark 时释放到 low_watermark。
+ * 提升上来的大页/映射共享栈直接释放，申请独享栈时不会要这两种
+ */
+static void co_stack_pool_put(stCoRoutineEnv_t* env, stStackMem_t* stack_mem) {
+  stCoStackPool_t* pool = &env->stack_pool;
+  stack_mem->occupy_co = NULL;
+
+  stCoStackBucket_t* bucket = NULL;
+  if (pool->high_watermark && !(stack_mem->alloc_flags & (CO_STACK_HUGEPAGE | CO_STACK_REMAP))) {
+    bucket = co_find_stack_bucket(pool, stack_mem->stack_size, stack_mem->pool_key);
+    for (int i = 0; !bucket && i < stCoStackPool_t::kBucketCount; i++) {
+      if (!pool->buckets[i].free_list) {
+        bucket = &pool->buckets[i];
+        bucket->stack_size = stack_mem->stack_size;
+        bucket->flags = stack_mem->pool_key;
+      }
+    }
+  }
+  if (!bucket) {
+    co_free_stackmem(stack_mem);
+    env->stat.stack_pool_free++;
+    return;
+  }
+
+  stack_mem->pNext = bucket->free_list;
+  bucket->free_list = stack_mem;
+  bucket->count++;
+  pool->cached_bytes += stack_mem->stack_size;
+  env->stat.stack_pool_put++;
+
+  if (pool->cached_bytes > pool->high_watermark) {
+    co_stack_pool_trim(env, pool->low_watermark);
+  }
+}
+
 /**
  * 初始化当前线程(中所有的协程)的共享栈(当前线程中的所有协程共享的栈)
  * @param count      预分配的 count 个协程栈
  * @param stack_size 每个协程栈大小
  */
 stShareStack_t* co_alloc_sharestack(int count, int stack_size) {
-  stShareStack_t* share_stack = (stShareStack_t*) malloc(sizeof(stShareStack_t));
-  share_stack->alloc_idx = 0;
-  share_stack->stack_size = stack_size;
+  return co_alloc_sharestack_ex(count, stack_size, 0);
+}
+
+static const size_t kCoHugePageSize = 2 * 1024 * 1024;
+
+/**
+ * 按 2MB 对齐映射一块大页内存：先试预留的大页(MAP_HUGETLB)，失败再用普通匿名映射 + 透明大页
+ * @param size 已按 2MB 取整
+ */
+static char* co_mmap_hugepage(size_t size) {
+#if defined(MAP_HUGETLB)
+  // 不能带 MAP_NORESERVE：大页池不够时应当在这里失败，而不是在第一次访问时 SIGBUS
+  void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (addr != MAP_FAILED) {
+    return (char*) addr;
+  }
+#endif
+#if defined(MADV_HUGEPAGE)
+  // 多映射 2MB，裁掉首尾让起始地址 2MB 对齐，透明大页才能整页映射
+  size_t map_size = size + kCoHugePageSize;
+  char* raw = (char*) mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  char* aligned = (char*) (((uintptr_t) raw + kCoHugePageSize - 1) & ~(uintptr_t) (kCoHugePageSize - 1));
+  if (aligned > raw) {
+    munmap(raw, aligned - raw);
+  }
+  if (raw + map_size > aligned + size) {
+    munmap(aligned + size, raw + map_size - (aligned + size));
+  }
+  if (madvise(aligned, size, MADV_HUGEPAGE) != 0) { // 内核不支持透明大页
+    munmap(aligned, size);
+    return NULL;
+  }
+  return aligned;
+#else
+  return NULL;
+#endif
+}
+
+/**
+ * 分配 count 块 stack_size 的共享栈到 stack_array
+ */
+static void co_alloc_share_stacks(stStackMem_t** stack_array, int count, int stack_size, int flags) {
+  char* arena = NULL;
+#if defined(__linux__)
+  if (flags & CO_STACK_REMAP) { // 映射要求栈按页对齐，所以一定 mmap 分配，不和大页 arena 一起用
+    flags = (flags | CO_STACK_MMAP) & ~CO_STACK_HUGEPAGE;
+  }
+#endif
+  if (flags & CO_STACK_HUGEPAGE) {
+    size_t stride = (stack_size + 15) & ~15; // 每个栈的 stack_bp 保持16字节对齐
+    size_t size = (stride * count + kCoHugePageSize - 1) & ~(kCoHugePageSize - 1);
+    arena = co_mmap_hugepage(size);
+    if (arena) {
+      int node = (flags & CO_STACK_NUMA) ? co_numa_node() : -1;
+      if (node >= 0 && co_numa_bind(arena, size, node)) {
+        co_numa_prefault(arena, size);
+      } else {
+        node = -1;
+      }
+      for (int i = 0; i < count; i++) {
+        stStackMem_t* stack_mem = (stStackMem_t*) calloc(1, sizeof(stStackMem_t));
+        stack_mem->stack_size = stack_size;
+        stack_mem->stack_buffer = arena + stride * i;
+        stack_mem->stack_bp = stack_mem->stack_buffer + stack_size;
+        stack_mem->alloc_flags = CO_STACK_HUGEPAGE | (node >= 0 ? CO_STACK_NUMA : 0);
+        stack_mem->numa_node = node;
+        stack_array[i] = stack_mem;
+      }
+    } else {
+      co_log_err("CO_ERR: co_alloc_sharestack_ex hugepage arena %zu failed errno %d, fallback", size, errno);
+    }
+  }
+  if (!arena) {
+    for (int i = 0; i < count; i++) {
+      stack_array[i] = co_alloc_stackmem(stack_size, flags & ~(CO_STACK_HUGEPAGE | CO_STACK_REMAP));
+      stStackMem_t* stack_mem = stack_array[i];
+      if ((stack_mem->alloc_flags & CO_STACK_NUMA) && !(stack_mem->alloc_flags & CO_STACK_GROWABLE)) {
+        co_numa_prefault(stack_mem->stack_buffer, stack_size); // 共享栈迟早整块用到，现在就在本节点上分配好
+      }
+#if defined(__linux__)
+      if ((flags & CO_STACK_REMAP) && (stack_mem->alloc_flags & CO_STACK_MMAP) &&
+          !(stack_mem->alloc_flags & CO_STACK_GROWABLE)) {
+        stack_mem->remap_fd = memfd_create("libco-stack", MFD_CLOEXEC);
+        if (stack_mem->remap_fd >= 0) {
+          stack_mem->alloc_flags |= CO_STACK_REMAP;
+        } else {
+          co_log_err("CO_ERR: memfd_create errno %d, shared stack falls back to memcpy", errno);
+        }
+      }
+#endif
+    }
+  }
+}
+
+/**
+ * 初始化共享栈，flags 带 CO_STACK_HUGEPAGE 时所有栈连续切自同一块大页映射
+ * 共享栈跟随进程存在，不释放
+ */
+stShareStack_t* co_alloc_sharestack_ex(int count, int stack_size, int flags) {
+  return co_alloc_sharestack_classes(1, &count, &stack_size, flags);
+}
+
+stShareStack_t* co_alloc_sharestack_classes(int class_count, const int* counts, const int* stack_sizes, int flags) {
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (env && env->numa_local) {
+    flags |= CO_STACK_NUMA;
+  }
+  stShareStack_t* share_stack = (stShareStack_t*) calloc(1, sizeof(stShareStack_t));
+  share_stack->policy = CO_SHARE_ROUND_ROBIN;
+  share_stack->class_count = class_count;
+  share_stack->classes = (stShareStackClass_t*) calloc(class_count, sizeof(stShareStackClass_t));
+
+  // 档位按栈大小从小到大排(插入排序，档位数很少)
+  for (int i = 0; i < class_count; i++) {
+    int j = i;
+    while (j > 0 && share_stack->classes[j - 1].stack_size > stack_sizes[i]) {
+      share_stack->classes[j] = share_stack->classes[j - 1];
+      j--;
+    }
+    share_stack->classes[j].stack_size = stack_sizes[i];
+    share_stack->classes[j].count = counts[i];
+    share_stack->count += counts[i];
+  }
+  share_stack->stack_size = share_stack->classes[class_count - 1].stack_size;
 
   // alloc stack array
-  share_stack->count = count;
-  stStackMem_t** stack_array = (stStackMem_t**) calloc(count, sizeof(stStackMem_t*));
-  for (int i = 0; i < count; i++) {
-    stack_array[i] = co_alloc_stackmem(stack_size);
+  stStackMem_t** stack_array = (stStackMem_t**) calloc(share_stack->count, sizeof(stStackMem_t*));
+  int begin = 0;
+  for (int i = 0; i < class_count; i++) {
+    stShareStackClass_t* cls = &share_stack->classes[i];
+    cls->begin = begin;
+    co_alloc_share_stacks(stack_array + begin, cls->count, cls->stack_size, flags);
+    begin += cls->count;
   }
   share_stack->stack_array = stack_array;
   return share_stack;
 }
 
-static stStackMem_t* co_get_stackmem(stShareStack_t* share_stack) {
+void co_set_sharestack_policy(stShareStack_t* share_stack, int policy) {
+  share_stack->policy = policy;
+}
+
+/**
+ * CO_SHARE_REBALANCE 每分配这么多次(乘以档内栈数)，把各块栈的 save_bytes 减半，只看最近的冲突率
+ */
+static const unsigned int kCoShareDecayPeriod = 8;
+
+/**
+ * 按 stack_size 选档位，再按分配策略在档内选一块栈
+ */
+static stStackMem_t* co_get_stackmem(stShareStack_t* share_stack, int stack_size) {
   if (!share_stack) {
     return NULL;
   }
-  int idx = share_stack->alloc_idx % share_stack->count;
+  stShareStackClass_t* cls = &share_stack->classes[share_stack->class_count - 1];
+  for (int i = 0; i < share_stack->class_count; i++) {
+    if (share_stack->classes[i].stack_size >= stack_size) {
+      cls = &share_stack->classes[i];
+      break;
+    }
+  }
+  stStackMem_t** stacks = share_stack->stack_array + cls->begin;
+
+  // 从轮转位置开始扫描，分数相同时退化成 round-robin；等待提升的栈跳过(全都在等时不跳)
+  int start = cls->alloc_idx % cls->count;
+  cls->alloc_idx++;
   share_stack->alloc_idx++;
+  for (int n = 0; n < cls->count && stacks[start]->pinned_co; n++) {
+    start = (start + 1) % cls->count;
+  }
+  if (share_stack->policy == CO_SHARE_ROUND_ROBIN) {
+    return stacks[start];
+  }
+
+  if (share_stack->policy == CO_SHARE_REBALANCE && cls->alloc_idx % (kCoShareDecayPeriod * cls->count) == 0) {
+    for (int i = 0; i < cls->count; i++) {
+      stacks[i]->save_bytes >>= 1;
+    }
+  }
 
-  return share_stack->stack_array[idx];
+  int best = start;
+  for (int n = 1; n < cls->count; n++) {
+    int i = (start + n) % cls->count;
+    stStackMem_t* cand = stacks[i];
+    stStackMem_t* cur = stacks[best];
+    if (cand->pinned_co) {
+      continue;
+    }
+    bool better = false;
+    switch (share_stack->policy) {
+      case CO_SHARE_LEAST_OCCUPIED:
+        better = cand->share_co_count < cur->share_co_count;
+        break;
+      case CO_SHARE_LEAST_RECENT:
+        better = cand->last_swap < cur->last_swap;
+        break;
+      case CO_SHARE_REBALANCE:
+        better = cand->save_bytes < cur->save_bytes ||
+                 (cand->save_bytes == cur->save_bytes && cand->share_co_count < cur->share_co_count);
+        break;
+    }
+    if (better) {
+      best = i;
+    }
+  }
+  return stacks[best];
 }
 
 // ----------------------------------------------------------------------------
@@ -329,6 +1017,10 @@ struct stCoEpoll_t {
   struct stTimeoutItemLink_t* pstActiveList;
   
   co_epoll_res* result;
+
+  int group_by_stack; // 见 co_eventloop_set_stack_grouping()
+  int group_cap;
+  struct stTimeoutItem_t** group_items; // 分组排序用的临时数组
 };
 
 typedef void (*OnPreparePfn_t) (stTimeoutItem_t*, 
@@ -447,16 +1139,28 @@ inline void TakeAllTimeout(stTimeout_t* apTimeout, unsigned long long allNow,
   apTimeout->llStartIdx += cnt - 1;
 }
 
+static void co_stack_profile_record(stCoRoutineEnv_t* env, stCoRoutine_t* co);
+static void co_share_stop(stCoRoutine_t* co);
+static void co_arena_release(stCoRoutine_t* co);
+
 /**
  * CoRoutineFunc - 所有新协程第一次被调度执行时的入口函数, 新协程在该入口函数中被执行
+ * 它是协程栈上最外层的C++帧，展开器(backtrace/gdb/perf)在这里结束，所以不是 static，便于按符号识别
  * @param co -        (input) 第一次被调度的协程
  * @param 未命名指针 - (input) 用于兼容函数类型
  */
-static int CoRoutineFunc(stCoRoutine_t* co, void*) {
+int CoRoutineFunc(stCoRoutine_t* co, void*) {
   if (co->pfn) {
     co->pfn(co->arg);
   }
+  co_arena_release(co);
+  if (co->cIsShareStack) {
+    co_share_stop(co);
+  }
   co->cEnd = 1; // 协程执行结束
+  if (co->cStackPainted) {
+    co_stack_profile_record(co->env, co);
+  }
 
   stCoRoutineEnv_t* env = co->env; // 获取当前线程的调度器
   
@@ -466,49 +1170,146 @@ static int CoRoutineFunc(stCoRoutine_t* co, void*) {
 }
 
 /**
- * co_create_env - 分配协程存储空间(stCoRoutine_t)并初始化其中的部分成员变量
- * @param env - (input) 当前线程环境,用于初始化协程存储结构stCoRoutine_t
- * @param pfn - (input) 协程函数,用于初始化协程存储结构stCoRoutine_t
- * @param arg - (input) 协程函数的参数,用于初始化协程存储结构stCoRoutine_t
- * @return stCoRoutine_t类型的指针，返回一个协程对象实例
+ * co_set_numa_local 打开时的协程对象：按块 mmap 并 mbind 到当前线程的节点，
+ * co_free 时挂回所属线程的空闲链表(块本身不释放)
  */
-struct stCoRoutine_t* co_create_env(stCoRoutineEnv_t* env,
-                                    const stCoRoutineAttr_t* attr,
-                                    pfn_co_routine_t pfn, void* arg) {
+static const int kCoNumaObjPerChunk = 32;
+
+static stCoRoutine_t* co_numa_obj_alloc(stCoRoutineEnv_t* env) {
+  if (!env->numa_obj_free) {
+    size_t page = co_page_size();
+    size_t size = (sizeof(stCoRoutine_t) * kCoNumaObjPerChunk + page - 1) & ~(page - 1);
+    char* chunk = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+      return NULL;
+    }
+    co_numa_bind(chunk, size, co_numa_node());
+    for (int i = kCoNumaObjPerChunk - 1; i >= 0; i--) {
+      stCoRoutine_t* co = (stCoRoutine_t*) (chunk + sizeof(stCoRoutine_t) * i);
+      *(stCoRoutine_t**) co = env->numa_obj_free;
+      env->numa_obj_free = co;
+    }
+  }
+  stCoRoutine_t* co = env->numa_obj_free;
+  env->numa_obj_free = *(stCoRoutine_t**) co;
+  return co;
+}
 
-  stCoRoutineAttr_t at;
+void co_set_numa_local(int enable) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  co_get_curr_thread_env()->numa_local = enable;
+}
+
+/**
+ * 规整 attr：默认 128K，最大 8M，按 4K 取整
+ */
+static void co_normalize_attr(const stCoRoutineAttr_t* attr, stCoRoutineAttr_t* at) {
   if (attr) {
-    memcpy(&at, attr, sizeof(at));
+    memcpy(at, attr, sizeof(*at));
   }
-  if (at.stack_size <= 0) { // 128k
-    at.stack_size = 128 * 1024;
-  } else if (at.stack_size > 1024 * 1024 * 8) { // 8M
-    at.stack_size = 1024 * 1024 * 8;
+  if (at->stack_size <= 0) { // 128k
+    at->stack_size = 128 * 1024;
+  } else if (at->stack_size > 1024 * 1024 * 8) { // 8M
+    at->stack_size = 1024 * 1024 * 8;
   }
 
-  if (at.stack_size & 0xFFF) {
-    at.stack_size &= ~0xFFF;
-    at.stack_size += 0x1000;
+  if (at->stack_size & 0xFFF) {
+    at->stack_size &= ~0xFFF;
+    at->stack_size += 0x1000;
   }
 
-  stCoRoutine_t* lp = (stCoRoutine_t*) malloc(sizeof(stCoRoutine_t));
+#if defined(__LIBCO_PRIVATE_STACK_ONLY__)
+  at->share_stack = NULL; // 只有独享栈的构建里 co_swap 不处理共享栈的拷贝
+#endif
+}
 
-  memset(lp, 0, (long) (sizeof(stCoRoutine_t)));
+/**
+ * 挂进本线程的协程链表(空闲回收、休眠扫描用)
+ */
+static void co_link_routine(stCoRoutineEnv_t* env, stCoRoutine_t* co) {
+  co->pPrevCo = NULL;
+  co->pNextCo = env->pCoList;
+  if (env->pCoList) {
+    env->pCoList->pPrevCo = co;
+  }
+  env->pCoList = co;
+}
+
+static void co_unlink_routine(stCoRoutine_t* co) {
+  if (co->pPrevCo) {
+    co->pPrevCo->pNextCo = co->pNextCo;
+  } else if (co->env->pCoList == co) {
+    co->env->pCoList = co->pNextCo;
+  }
+  if (co->pNextCo) {
+    co->pNextCo->pPrevCo = co->pPrevCo;
+  }
+  co->pPrevCo = NULL;
+  co->pNextCo = NULL;
+}
+
+/**
+ * 换一个入口函数重新开始：私有变量、环境变量副本和 hook 开关回到新建时的状态。
+ * 私有变量的值和 pvEnv 与 co_free 一样不释放，由使用者管理
+ */
+static void co_rebind(stCoRoutine_t* co, pfn_co_routine_t pfn, void* arg) {
+  co->pfn = pfn;
+  co->arg = arg;
+  co->cEnableSysHook = 0;
+  co->pvEnv = NULL;
+  memset(co->aSpecKey, 0, sizeof(co->aSpecKey));
+  free(co->pSpecTable);
+  co->pSpecTable = NULL;
+}
+
+/**
+ * 复用链表里只看前面几个，栈的配置对不上就新建；一个线程里的协程通常只有一两种配置。
+ * 共享栈协程停着时不挂在任何一块栈上，只要是同一个共享栈就能用，取出后按 stack_size 重新选档位和栈
+ */
+static const int kCoReuseScan = 8;
+
+static stCoRoutine_t* co_reuse_get(stCoRoutineEnv_t* env, const stCoRoutineAttr_t& at) {
+  stCoRoutine_t** pp = &env->reuse_list;
+  for (int i = 0; *pp && i < kCoReuseScan; i++, pp = &(*pp)->pNextCo) {
+    stCoRoutine_t* co = *pp;
+    bool match = co->cIsShareStack ? co->share_stack == at.share_stack
+                                   : !at.share_stack && co->ctx.ss_size == (size_t) at.stack_size &&
+                                     co->stack_flags == at.stack_flags;
+    if (match) {
+      *pp = co->pNextCo;
+      co->pNextCo = NULL;
+      env->reuse_count--;
+      env->stat.reuse_hit++;
+      return co;
+    }
+  }
+  return NULL;
+}
 
+/**
+ * 初始化已清零的协程对象 lp：分配栈(stack_mem 非空时直接用它作为独享栈)，挂进本线程的协程链表
+ */
+static void co_init_routine(stCoRoutineEnv_t* env, stCoRoutine_t* lp, stCoRoutineAttr_t& at,
+                            pfn_co_routine_t pfn, void* arg, stStackMem_t* stack_mem) {
   lp->env = env;
   lp->pfn = pfn;
   lp->arg = arg;
 
-  stStackMem_t* stack_mem = NULL;
-  if (at.share_stack) { // 共享栈模式
-    stack_mem = co_get_stackmem(at.share_stack);
-    at.stack_size = at.share_stack->stack_size;
-  } else { // 独享栈模式
-    stack_mem = co_alloc_stackmem(at.stack_size);
-  }
+  if (stack_mem) {
+    // co_create_batch 从 slab 里切出来的独享栈
+  } else if (at.share_stack) { // 共享栈模式
+    stack_mem = co_get_stackmem(at.share_stack, at.stack_size);
+    stack_mem->share_co_count++;
+    at.stack_size = stack_mem->stack_size;
+  } else if (!env->stack_pool.lazy_alloc) { // 独享栈模式
+    stack_mem = co_stack_pool_get(env, at.stack_size, at.stack_flags);
+  } // else: 延迟到第一次运行时再分配，见 co_start()
   lp->stack_mem = stack_mem; // 独享栈
+  lp->stack_flags = at.stack_flags;
 
-  lp->ctx.ss_sp = stack_mem->stack_buffer;
+  lp->ctx.ss_sp = stack_mem ? stack_mem->stack_buffer : NULL;
   lp->ctx.ss_size = at.stack_size;
 
   lp->cStart = 0;
@@ -516,10 +1317,51 @@ struct stCoRoutine_t* co_create_env(stCoRoutineEnv_t* env,
   lp->cIsMain = 0;
   lp->cEnableSysHook = 0;
   lp->cIsShareStack = at.share_stack != NULL;
+  lp->share_stack = at.share_stack;
 
   lp->save_size = 0;
+  lp->save_cap = 0;
   lp->save_buffer = NULL;
 
+  co_link_routine(env, lp);
+}
+
+/**
+ * co_create_env - 分配协程存储空间(stCoRoutine_t)并初始化其中的部分成员变量
+ * @param env - (input) 当前线程环境,用于初始化协程存储结构stCoRoutine_t
+ * @param pfn - (input) 协程函数,用于初始化协程存储结构stCoRoutine_t
+ * @param arg - (input) 协程函数的参数,用于初始化协程存储结构stCoRoutine_t
+ * @return stCoRoutine_t类型的指针，返回一个协程对象实例
+ */
+struct stCoRoutine_t* co_create_env(stCoRoutineEnv_t* env,
+                                    const stCoRoutineAttr_t* attr,
+                                    pfn_co_routine_t pfn, void* arg) {
+
+  stCoRoutineAttr_t at;
+  co_normalize_attr(attr, &at);
+
+  stCoRoutine_t* lp = env->reuse_list ? co_reuse_get(env, at) : NULL;
+  if (lp) { // co_release 停下来的协程：独享栈还在，只要重新绑定入口函数
+    co_rebind(lp, pfn, arg);
+    if (lp->cIsShareStack) {
+      lp->stack_mem = co_get_stackmem(at.share_stack, at.stack_size);
+      lp->stack_mem->share_co_count++;
+      lp->ctx.ss_sp = lp->stack_mem->stack_buffer;
+      lp->ctx.ss_size = lp->stack_mem->stack_size;
+    }
+    co_link_routine(env, lp);
+    return lp;
+  }
+
+  lp = env->numa_local ? co_numa_obj_alloc(env) : NULL;
+  bool numa_obj = lp != NULL;
+  if (!lp && posix_memalign((void**) &lp, alignof(stCoRoutine_t), sizeof(stCoRoutine_t)) != 0) {
+    lp = NULL; // 热字段按 cache line 对齐放，见 stCoRoutine_t
+  }
+
+  memset(lp, 0, (long) (sizeof(stCoRoutine_t)));
+  lp->cNumaObj = numa_obj;
+  co_init_routine(env, lp, at, pfn, arg, NULL);
   return lp;
 }
 
@@ -543,28 +1385,316 @@ int co_create(stCoRoutine_t** ppco,
   return 0;
 }
 
-void co_free(stCoRoutine_t* co) {
+/**
+ * co_create_batch 的一批协程对象和独享栈所在的两块连续内存，两者都释放完后整块 munmap
+ */
+struct stCoBatchSlab_t {
+  char* obj_base;
+  size_t obj_bytes;
+  char* stack_base;
+  size_t stack_bytes;
+  stStackMem_t* stack_mems; // 独享栈的描述，连续数组
+  int live; // 还没释放的协程对象数 + 独享栈数
+};
+
+static void co_batch_put(stCoBatchSlab_t* batch) {
+  if (--batch->live) {
+    return;
+  }
+  munmap(batch->obj_base, batch->obj_bytes);
+  if (batch->stack_base) {
+    munmap(batch->stack_base, batch->stack_bytes);
+  }
+  free(batch->stack_mems);
+  free(batch);
+}
+
+/**
+ * 批量创建的独享栈不进回收池：页还给内核，等整批都释放后再 munmap
+ */
+static void co_batch_put_stack(stStackMem_t* stack_mem) {
+  madvise(stack_mem->stack_buffer, stack_mem->stack_size, MADV_DONTNEED);
+  co_batch_put(stack_mem->batch);
+}
+
+static void co_start(stCoRoutine_t* co);
+
+int co_create_batch(stCoRoutine_t** ppco, int n, const stCoRoutineAttr_t* attr, pfn_co_routine_t pfn,
+                    void** args, int flags) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  stCoRoutineAttr_t at;
+  co_normalize_attr(attr, &at);
+  if (n <= 0) {
+    return 0;
+  }
+  if (at.stack_flags & CO_STACK_GROWABLE) { // 可增长栈各自保留地址空间，没法连续切分，逐个创建
+    for (int i = 0; i < n; i++) {
+      co_create(&ppco[i], &at, pfn, args ? args[i] : NULL);
+    }
+    return 0;
+  }
+#if defined(__LIBCO_PRIVATE_STACK_ONLY__)
+  at.share_stack = NULL;
+#endif
+
+  size_t page = co_page_size();
+  int node = (env->numa_local || (at.stack_flags & CO_STACK_NUMA)) ? co_numa_node() : -1;
+  // 先 mbind 再缺页；MAP_POPULATE 会在 mmap 里直接分配，所以绑节点时改为事后逐页触碰
+  int populate = (flags & CO_BATCH_POPULATE) && node < 0 ? MAP_POPULATE : 0;
+
+  stCoBatchSlab_t* batch = (stCoBatchSlab_t*) calloc(1, sizeof(stCoBatchSlab_t));
+  batch->obj_bytes = (sizeof(stCoRoutine_t) * n + page - 1) & ~(page - 1);
+  batch->obj_base = (char*) mmap(NULL, batch->obj_bytes, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+  if (batch->obj_base == MAP_FAILED) {
+    free(batch);
+    return -1;
+  }
+  if (node >= 0) {
+    co_numa_bind(batch->obj_base, batch->obj_bytes, node);
+    if (flags & CO_BATCH_POPULATE) {
+      co_numa_prefault(batch->obj_base, batch->obj_bytes);
+    }
+  }
+
+  // 独享栈：每块栈前面一页保护页(CO_STACK_MMAP 时，和 co_mmap_stack 一样)，栈本身不预先分配，
+  // 下面 co_start 的 coctx_make 只会碰到每块栈的栈顶
+  if (!at.share_stack) {
+    size_t guard = ((at.stack_flags | kCoDefaultStackFlags) & CO_STACK_MMAP) ? page : 0;
+    size_t stride = guard + at.stack_size;
+    batch->stack_bytes = stride * n;
+    batch->stack_base = (char*) mmap(NULL, batch->stack_bytes, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (batch->stack_base == MAP_FAILED) {
+      munmap(batch->obj_base, batch->obj_bytes);
+      free(batch);
+      return -1;
+    }
+    if (node >= 0) {
+      co_numa_bind(batch->stack_base, batch->stack_bytes, node);
+    }
+    batch->stack_mems = (stStackMem_t*) calloc(n, sizeof(stStackMem_t));
+    for (int i = 0; i < n; i++) {
+      stStackMem_t* stack_mem = &batch->stack_mems[i];
+      char* base = batch->stack_base + stride * i;
+      if (guard) {
+        mprotect(base, guard, PROT_NONE);
+      }
+      stack_mem->stack_size = at.stack_size;
+      stack_mem->stack_buffer = base + guard;
+      stack_mem->stack_bp = stack_mem->stack_buffer + at.stack_size;
+      // CO_STACK_MMAP 表示栈下面有保护页，没有保护页的切片不标
+      stack_mem->alloc_flags = (guard ? CO_STACK_MMAP : 0) | (node >= 0 ? CO_STACK_NUMA : 0);
+      stack_mem->numa_node = node;
+      stack_mem->batch = batch;
+    }
+  }
+
+  batch->live = at.share_stack ? n : n * 2;
+  for (int i = 0; i < n; i++) {
+    stCoRoutine_t* co = (stCoRoutine_t*) (batch->obj_base + sizeof(stCoRoutine_t) * i); // 新映射的页已经是零
+    co->batch = batch;
+    co_init_routine(env, co, at, pfn, args ? args[i] : NULL, at.share_stack ? NULL : &batch->stack_mems[i]);
+    if (!co->cIsShareStack) { // 共享栈协程开始运行时还可能按策略换栈，留给第一次 co_resume
+      co_start(co);
+    }
+    ppco[i] = co;
+  }
+  return 0;
+}
+
+static void co_release_save_buffer(stCoRoutine_t* co);
+static void co_remap_release(stCoRoutine_t* co);
+static void co_hib_release(stCoRoutine_t* co);
+
+/**
+ * 共享栈协程的栈帧不再需要保留(结束、释放或重置)
+ */
+static void co_share_stop(stCoRoutine_t* co) {
+  if (co->cStart && !co->cEnd) {
+    co->stack_mem->share_live_count--;
+  }
+  if (co->stack_mem->pinned_co == co) {
+    co->stack_mem->pinned_co = NULL;
+  }
+  co->cPromote = 0;
+}
+
+static void co_free_routine(stCoRoutine_t* co) {
+  if (co->cStackPainted && !co->cEnd) { // 结束时已经测量过
+    co_stack_profile_record(co->env, co);
+  }
+  co_hib_release(co);
+  co_arena_release(co);
   if (!co->cIsShareStack) {
-    free(co->stack_mem->stack_buffer);
-    free(co->stack_mem);
-  } else { // walkerdu fix at 2018-01-20 存在内存泄漏
-    if (co->save_buffer) {
-      free(co->save_buffer);
+    if (co->stack_mem && co->stack_mem->batch) {
+      co_batch_put_stack(co->stack_mem);
+    } else if (co->stack_mem) { // 延迟分配且从未运行过的协程没有栈
+      co_stack_pool_put(co->env, co->stack_mem);
     }
+  } else if (co->stack_mem) { // walkerdu fix at 2018-01-20 存在内存泄漏(停在复用链表里的没有栈)
+    co_release_save_buffer(co);
+    co_remap_release(co);
 
     if (co->stack_mem->occupy_co == co) {
       co->stack_mem->occupy_co = NULL;
     }
+    co->stack_mem->share_co_count--;
+    co_share_stop(co);
   }
 
+  co_unlink_routine(co);
+
+  free(co->pSpecTable);
+  if (co->batch) {
+    co_batch_put(co->batch);
+    return;
+  }
+  if (co->cNumaObj) {
+    *(stCoRoutine_t**) co = co->env->numa_obj_free;
+    co->env->numa_obj_free = co;
+    return;
+  }
   free(co);
 }
+
+/**
+ * 复用链表没满时 co_release 不释放协程：做一遍 co_reset，独享栈留在协程上，下一次 co_create 直接拿来用。
+ * 共享栈协程则放开所在的栈：停着期间那块栈可能被 co_promote_share_stack 转给热点协程
+ */
+static bool co_reuse_park(stCoRoutine_t* co) {
+  stCoRoutineEnv_t* env = co->env;
+  if (env->reuse_count >= env->reuse_max || co->cIsMain) {
+    return false;
+  }
+  co_reset(co);
+  co_rebind(co, NULL, NULL);
+  if (co->cIsShareStack) {
+    co->stack_mem->share_co_count--;
+    co->stack_mem = NULL;
+    co->ctx.ss_sp = NULL;
+  }
+  co_unlink_routine(co);
+  co->pNextCo = env->reuse_list;
+  env->reuse_list = co;
+  env->reuse_count++;
+  return true;
+}
+
+/**
+ * 真正释放复用链表里多出来的协程
+ */
+static void co_reuse_trim(stCoRoutineEnv_t* env, unsigned int max) {
+  while (env->reuse_count > max) {
+    stCoRoutine_t* co = env->reuse_list;
+    env->reuse_list = co->pNextCo;
+    env->reuse_count--;
+    co->pNextCo = NULL;
+    co_free_routine(co);
+  }
+}
+
+void co_free(stCoRoutine_t* co) {
+  if (!co_reuse_park(co)) {
+    co_free_routine(co);
+  }
+}
+
 void co_release(stCoRoutine_t* co) { 
   co_free(co); 
 }
 
 void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co);
 
+/**
+ * 栈剖析：开始运行前把整个栈填成 kCoStackPaint，之后从栈底(低地址)往上找第一个被改写的字
+ */
+static const uint64_t kCoStackPaint = 0xcdcdcdcdcdcdcdcdULL;
+
+static void co_stack_paint(stStackMem_t* stack_mem) {
+  memset(stack_mem->stack_buffer, 0xcd, stack_mem->stack_size);
+}
+
+static unsigned int co_stack_used(stStackMem_t* stack_mem) {
+  const uint64_t* p = (const uint64_t*) stack_mem->stack_buffer;
+  const uint64_t* end = (const uint64_t*) stack_mem->stack_bp;
+  while (p < end && *p == kCoStackPaint) {
+    p++;
+  }
+  return stack_mem->stack_bp - (const char*) p;
+}
+
+static void co_stack_profile_record(stCoRoutineEnv_t* env, stCoRoutine_t* co) {
+  stCoStackProfileTable_t* table = env->stack_profile;
+  if (!table) {
+    return;
+  }
+  unsigned int used = co_stack_used(co->stack_mem);
+
+  stCoStackProfileEntry_t* entry = NULL;
+  for (int i = 0; i < table->count; i++) {
+    if (table->entries[i].pfn == co->pfn) {
+      entry = &table->entries[i];
+      break;
+    }
+  }
+  if (!entry) {
+    if (table->count == stCoStackProfileTable_t::kMaxEntries) {
+      return;
+    }
+    entry = &table->entries[table->count++];
+    entry->pfn = co->pfn;
+  }
+  entry->samples++;
+  entry->total_used += used;
+  entry->stack_size = co->stack_mem->stack_size;
+  if (used > entry->max_used) {
+    entry->max_used = used;
+  }
+}
+
+/**
+ * coctx_make 构造的入口帧(参数、返回地址哨兵)都在栈顶这么多字节以内
+ */
+static const unsigned int kCoStartFrame = 64;
+
+/**
+ * 协程第一次运行前：补上延迟分配的独享栈，构造入口上下文
+ */
+static void co_start(stCoRoutine_t* co) {
+  if (co->cIsShareStack && co->share_stack->policy != CO_SHARE_ROUND_ROBIN) {
+    // 按当前各块栈的负载重新挑一块(同一档位)；还没运行的协程栈上没有内容，可以直接换
+    co->stack_mem->share_co_count--; // 不把自己算进负载
+    stStackMem_t* stack_mem = co_get_stackmem(co->share_stack, co->stack_mem->stack_size);
+    if (stack_mem != co->stack_mem && co->stack_mem->occupy_co == co) {
+      co->stack_mem->occupy_co = NULL;
+    }
+    stack_mem->share_co_count++;
+    co->stack_mem = stack_mem;
+    co->ctx.ss_sp = stack_mem->stack_buffer;
+  }
+  if (!co->stack_mem) {
+    co->stack_mem = co_stack_pool_get(co->env, co->ctx.ss_size, co->stack_flags);
+    co->ctx.ss_sp = co->stack_mem->stack_buffer;
+  }
+  if (co->cIsShareStack) {
+    co->stack_mem->share_live_count++;
+    co->promo_bytes = 0;
+  }
+  co->cStackPainted = 0;
+  if (co->env->stack_profile && co->env->stack_profile->enable && !co->cIsShareStack) {
+    co_stack_paint(co->stack_mem);
+    co->cStackPainted = 1;
+  }
+  coctx_make(&co->ctx, (coctx_pfn_t) CoRoutineFunc, co, 0);
+  // 还没切换进去过的协程，栈上只有 coctx_make 在栈顶写的入口帧；co_trim_stack/co_hibernate 据此保留栈顶
+  co->stack_sp = co->stack_mem->stack_bp - kCoStartFrame;
+  co->cStart = 1;
+}
+
 /**
  * 通过co_resume来使协程获得执行权
  */
@@ -573,8 +1703,7 @@ void co_resume(stCoRoutine_t* co) {
   // 有可能是(非)主协程(main)
   stCoRoutine_t* lpCurrRoutine = env->pCallStack[env->iCallStackSize - 1];
   if (!co->cStart) { // 目标协程还没启动过：即第1次启动
-    coctx_make(&co->ctx, (coctx_pfn_t) CoRoutineFunc, co, 0);
-    co->cStart = 1; // 标识该协程已经启动过了
+    co_start(co); // 标识该协程已经启动过了
   }
   env->pCallStack[env->iCallStackSize++] = co;
 
@@ -588,21 +1717,134 @@ void co_reset(stCoRoutine_t* co) {
   if (!co->cStart || co->cIsMain)
     return;
 
+  if (co->cStackPainted && !co->cEnd) {
+    co_stack_profile_record(co->env, co);
+  }
+  if (co->cIsShareStack) {
+    co_share_stop(co);
+  }
+  co->cStackPainted = 0;
   co->cStart = 0;
   co->cEnd = 0;
+  co_hib_release(co);
+  co_arena_release(co);
 
   // 如果当前协程有共享栈被切出的buff，要进行释放
-  if (co->save_buffer) {
-    free(co->save_buffer);
-    co->save_buffer = NULL;
-    co->save_size = 0;
-  }
+  co_release_save_buffer(co);
+  co_remap_release(co);
 
   // 如果共享栈被当前协程占用，要释放占用标志，否则被切换，会执行save_stack_buffer()
-  if (co->stack_mem->occupy_co == co)
+  if (co->stack_mem && co->stack_mem->occupy_co == co)
     co->stack_mem->occupy_co = NULL;
 }
 
+/**
+ * 让已经结束(或还没开始)的协程换一个入口函数，原地重新开始，不用 co_release + co_create
+ */
+int co_reuse(stCoRoutine_t* co, pfn_co_routine_t pfn, void* arg) {
+  if (co->cIsMain || (co->cStart && !co->cEnd)) {
+    return -1;
+  }
+  co_reset(co);
+  co_rebind(co, pfn, arg);
+  return 0;
+}
+
+/**
+ * stCoSlab_t 每次补充的对象数
+ */
+static const int kCoSlabChunkObjs = 64;
+
+void* co_slab_alloc(stCoSlab_t* slab, size_t obj_size) {
+  if (!slab->free_list) {
+    size_t stride = (obj_size + 15) & ~(size_t) 15;
+    char* chunk = (char*) malloc(stride * kCoSlabChunkObjs);
+    if (!chunk) {
+      return NULL;
+    }
+    for (int i = kCoSlabChunkObjs - 1; i >= 0; i--) {
+      co_slab_free(slab, chunk + stride * i);
+    }
+  }
+  void* p = slab->free_list;
+  slab->free_list = *(void**) p;
+  return p;
+}
+
+/**
+ * 数据区从头部之后按 16 字节对齐开始
+ */
+static const size_t kCoArenaHeader = (sizeof(stCoArenaChunk_t) + 15) & ~(size_t) 15;
+static const size_t kCoArenaStdSize = stCoArenaPool_t::kChunkSize - kCoArenaHeader;
+
+static stCoArenaChunk_t* co_arena_chunk_get(stCoRoutineEnv_t* env, size_t size) {
+  stCoArenaPool_t* pool = &env->arena_pool;
+  stCoArenaChunk_t* chunk;
+  if (size <= kCoArenaStdSize && pool->free_list) {
+    chunk = pool->free_list;
+    pool->free_list = chunk->next;
+    pool->count--;
+    env->stat.arena_chunk_reuse++;
+  } else {
+    size_t data_size = size <= kCoArenaStdSize ? kCoArenaStdSize : size;
+    chunk = (stCoArenaChunk_t*) malloc(kCoArenaHeader + data_size);
+    if (!chunk) {
+      return NULL;
+    }
+    chunk->size = data_size;
+    env->stat.arena_chunk_alloc++;
+  }
+  chunk->used = 0;
+  return chunk;
+}
+
+/**
+ * 在当前协程的区域里分配，协程结束、co_reset/co_reuse 或 co_release 时整体释放，不用逐个 free
+ */
+void* co_arena_alloc(size_t size) {
+  stCoRoutine_t* co = GetCurrThreadCo();
+  if (!co || co->cIsMain) { // 主协程不会结束，没有释放的时机
+    return NULL;
+  }
+  size = size ? (size + 15) & ~(size_t) 15 : 16;
+
+  stCoArenaChunk_t* chunk = co->arena;
+  if (!chunk || chunk->size - chunk->used < size) {
+    chunk = co_arena_chunk_get(co->env, size);
+    if (!chunk) {
+      return NULL;
+    }
+    if (co->arena && size > kCoArenaStdSize) {
+      // 单独分配的大块挂在当前块后面，当前块剩下的空间还能继续分配
+      chunk->next = co->arena->next;
+      co->arena->next = chunk;
+    } else {
+      chunk->next = co->arena;
+      co->arena = chunk;
+    }
+  }
+  void* p = (char*) chunk + kCoArenaHeader + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+static void co_arena_release(stCoRoutine_t* co) {
+  stCoArenaPool_t* pool = &co->env->arena_pool;
+  stCoArenaChunk_t* chunk = co->arena;
+  co->arena = NULL;
+  while (chunk) {
+    stCoArenaChunk_t* next = chunk->next;
+    if (chunk->size == kCoArenaStdSize && pool->count < stCoArenaPool_t::kMaxCached) {
+      chunk->next = pool->free_list;
+      pool->free_list = chunk;
+      pool->count++;
+    } else {
+      free(chunk);
+    }
+    chunk = next;
+  }
+}
+
 /**
  * 让出当前协程，执行上一条协程
  * @param env 当前线程上下文，例如：正在运行的协程队列
@@ -617,26 +1859,406 @@ void co_yield_env(stCoRoutineEnv_t* env) {
   co_swap(curr, last); // 切换协程的控制权(上下文)
 }
 
+/**
+ * 对称切换：从当前协程直接切到 co，不经过调度链上的 resumer。
+ * co 顶替当前协程在 pCallStack 栈顶的位置(调用链深度不变)，当前协程被挂起且不在调用链上，
+ * 之后需要别人再 co_resume/co_transfer 它。co 执行完毕或 co_yield 时，回到原本会接收当前协程
+ * yield 的那个协程(pCallStack 的次栈顶)，即整条 transfer 链的 resumer。
+ * co 不能是调用链上的其他协程(次栈顶除外，此时等价于 co_yield)，也不能已经结束(上下文停在 CoRoutineFunc 的末尾)，
+ * 这两种情况返回 -1。
+ */
+int co_transfer(stCoRoutine_t* co) {
+  stCoRoutineEnv_t* env = co->env;
+  stCoRoutine_t* curr = env->pCallStack[env->iCallStackSize - 1];
+  if (co == curr) {
+    return 0;
+  }
+  if (co->cEnd) {
+    return -1;
+  }
+  if (env->iCallStackSize < 2) { // 主协程没有 resumer，不能被顶替，退化为 co_resume
+    co_resume(co);
+    return 0;
+  }
+  if (co == env->pCallStack[env->iCallStackSize - 2]) {
+    co_yield_env(env);
+    return 0;
+  }
+  for (int i = 0; i < env->iCallStackSize - 2; i++) { // 已经在调用链上，再压一次会被切回两次
+    if (env->pCallStack[i] == co) {
+      return -1;
+    }
+  }
+  if (!co->cStart) {
+    co_start(co);
+  }
+  env->pCallStack[env->iCallStackSize - 1] = co;
+
+  co_swap(curr, co);
+  return 0;
+}
+
 void co_yield_ct() { co_yield_env(co_get_curr_thread_env()); }
 void co_yield(stCoRoutine_t* co) {
   co_yield_env(co->env); 
 }
 
+/**
+ * 共享栈内容在 save_buffer 里的起始位置，和共享栈上的地址 stack_sp 在 cache line 内同相位，
+ * 这样换出/换入两个方向的 memcpy 源和目的都是同样的对齐，大块拷贝(rep movsb/向量循环)不会跨 cache line 拆分访问
+ */
+static const uintptr_t kCoSaveAlignMask = 63;
+
+static inline char* co_save_data(stCoRoutine_t* co) {
+  return co->save_buffer + ((uintptr_t) co->stack_sp & kCoSaveAlignMask);
+}
+
+static int co_save_buf_class(size_t size) {
+  size_t class_size = (size_t) 1 << stCoSaveBufPool_t::kMinShift;
+  for (int i = 0; i < stCoSaveBufPool_t::kClassCount; i++, class_size <<= 1) {
+    if (size <= class_size) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * 取一块至少 size 字节的 save_buffer，*cap 返回实际容量
+ */
+static char* co_save_buf_get(stCoRoutineEnv_t* env, size_t size, unsigned int* cap) {
+  stCoSaveBufPool_t* pool = &env->save_buf_pool;
+  int cls = co_save_buf_class(size);
+  if (cls < 0) { // 超过最大一级，不进池
+    env->stat.save_buf_alloc++;
+    *cap = size;
+    return (char*) malloc(size);
+  }
+
+  *cap = (size_t) 1 << (stCoSaveBufPool_t::kMinShift + cls);
+  void* buf = pool->free_list[cls];
+  if (buf) {
+    pool->free_list[cls] = *(void**) buf;
+    pool->count[cls]--;
+    env->stat.save_buf_pool_hit++;
+    return (char*) buf;
+  }
+  env->stat.save_buf_alloc++;
+  return (char*) malloc(*cap);
+}
+
+static void co_save_buf_put(stCoRoutineEnv_t* env, char* buf, unsigned int cap) {
+  stCoSaveBufPool_t* pool = &env->save_buf_pool;
+  int cls = co_save_buf_class(cap);
+  if (cls < 0 || ((size_t) 1 << (stCoSaveBufPool_t::kMinShift + cls)) != cap) {
+    free(buf);
+    return;
+  }
+  int max_count = stCoSaveBufPool_t::kClassBytes >> (stCoSaveBufPool_t::kMinShift + cls);
+  if (max_count < stCoSaveBufPool_t::kMinCount) {
+    max_count = stCoSaveBufPool_t::kMinCount;
+  }
+  if (pool->count[cls] >= max_count) {
+    free(buf);
+    return;
+  }
+  *(void**) buf = pool->free_list[cls];
+  pool->free_list[cls] = buf;
+  pool->count[cls]++;
+}
+
+/**
+ * 释放协程的 save_buffer (co_free/co_reset)
+ */
+static void co_release_save_buffer(stCoRoutine_t* co) {
+  if (co->save_buffer) {
+    co_save_buf_put(co->env, co->save_buffer, co->save_cap);
+    co->save_buffer = NULL;
+    co->save_size = 0;
+    co->save_cap = 0;
+  }
+}
+
+/**
+ * 记一笔协程的共享栈拷贝量，窗口内超过阈值时标记为待提升
+ */
+static inline void co_share_account(stCoRoutineEnv_t* env, stCoRoutine_t* co, unsigned int len) {
+  if (!env->promote_bytes) {
+    return;
+  }
+  if (env->share_swap_seq - co->promo_window_start > env->promote_window) {
+    co->promo_window_start = env->share_swap_seq;
+    co->promo_bytes = 0;
+  }
+  co->promo_bytes += len;
+  if (co->promo_bytes >= env->promote_bytes) {
+    co->cPromote = 1;
+  }
+}
+
+/**
+ * 把热点协程 co 所在的共享栈转给它作为独享栈，在它挂起(co_swap 切走)时调用，co 正在这块栈上运行。
+ * 第一次调用时先占住这块栈：不再分配给新协程，还没运行过的协程改到别的栈；
+ * 之后每次挂起检查一次，等栈上没有其他协程的栈帧了才真正转移
+ */
+static void co_promote_share_stack(stCoRoutineEnv_t* env, stCoRoutine_t* co) {
+  stStackMem_t* old = co->stack_mem;
+  if (old->alloc_flags & CO_STACK_REMAP) { // 映射模式本身就不拷贝深栈，而且 memfd 里有其他协程的后备页
+    co->cPromote = 0;
+    return;
+  }
+  if (old->pinned_co != co) {
+    if (old->pinned_co) { // 已经被别的热点协程占住了，等下一个窗口再试
+      co->cPromote = 0;
+      co->promo_bytes = 0;
+      return;
+    }
+    old->pinned_co = co;
+    env->stat.share_pinned++;
+    for (stCoRoutine_t* other = env->pCoList; other; other = other->pNextCo) {
+      if (other != co && other->stack_mem == old && other->cIsShareStack && !other->cStart) {
+        stStackMem_t* stack_mem = co_get_stackmem(other->share_stack, old->stack_size);
+        old->share_co_count--;
+        stack_mem->share_co_count++;
+        other->stack_mem = stack_mem;
+        other->ctx.ss_sp = stack_mem->stack_buffer;
+      }
+    }
+  }
+  if (old->share_live_count > 1) {
+    return;
+  }
+
+  // 共享栈里补一块新栈，剩下引用 old 的(已经结束的)协程也改过去
+  stShareStack_t* share_stack = co->share_stack;
+  stStackMem_t* fresh = co_alloc_stackmem(old->stack_size, old->alloc_flags & (CO_STACK_MMAP | CO_STACK_GROWABLE));
+  for (int i = 0; i < share_stack->count; i++) {
+    if (share_stack->stack_array[i] == old) {
+      share_stack->stack_array[i] = fresh;
+      break;
+    }
+  }
+  for (stCoRoutine_t* other = env->pCoList; other; other = other->pNextCo) {
+    if (other != co && other->stack_mem == old) {
+      other->stack_mem = fresh;
+      other->ctx.ss_sp = fresh->stack_buffer;
+      fresh->share_co_count++;
+    }
+  }
+
+  old->pinned_co = NULL;
+  old->share_co_count = 0;
+  old->share_live_count = 0;
+  co->cIsShareStack = 0;
+  co->cPromote = 0;
+  co_release_save_buffer(co);
+  env->stat.share_promoted++;
+}
+
+void co_set_share_promotion(unsigned long long copy_bytes, unsigned int window_swaps) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  env->promote_bytes = copy_bytes;
+  env->promote_window = window_swaps;
+}
+
+/**
+ * CO_STACK_REMAP：换出/换入改用映射的栈深度阈值
+ */
+static unsigned int gCoRemapThreshold = 192 * 1024;
+
+void co_set_share_remap_threshold(unsigned int bytes) {
+  gCoRemapThreshold = bytes;
+}
+
+/**
+ * 把 owner 的后备页映射到共享栈 stack_mem 的地址上，owner 为 NULL 时换成新的匿名页。
+ * remap_owner 记录的是映射在栈上的页属于谁，栈上当前的内容属于 occupy_co，两者可以不同(页被借用)；
+ * 调用时当前运行的栈不能是 stack_mem
+ */
+static bool co_remap_window(stCoRoutineEnv_t* env, stStackMem_t* stack_mem, stCoRoutine_t* owner) {
+#if defined(__linux__)
+  void* addr = owner ? mmap(stack_mem->stack_buffer, stack_mem->stack_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_FIXED, stack_mem->remap_fd, owner->remap_off)
+                     : mmap(stack_mem->stack_buffer, stack_mem->stack_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  if (addr == MAP_FAILED) {
+    co_log_err("CO_ERR: co_remap_window mmap errno %d", errno);
+    return false;
+  }
+  if (!owner && stack_mem->numa_node >= 0) { // MAP_FIXED 换掉了原来的映射，内存策略也要重新设置
+    co_numa_bind(stack_mem->stack_buffer, stack_mem->stack_size, stack_mem->numa_node);
+  }
+  stack_mem->remap_owner = owner;
+  env->stat.share_remap_count++;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * 给协程在 memfd 里分一段后备页
+ */
+static bool co_remap_alloc(stStackMem_t* stack_mem, stCoRoutine_t* co) {
+  if (co->cRemap) {
+    return true;
+  }
+  long off;
+  if (stack_mem->remap_free_count) {
+    off = stack_mem->remap_free[--stack_mem->remap_free_count];
+  } else {
+    off = stack_mem->remap_file_size;
+    if (ftruncate(stack_mem->remap_fd, off + stack_mem->stack_size) != 0) {
+      return false;
+    }
+    stack_mem->remap_file_size = off + stack_mem->stack_size;
+  }
+  co->remap_off = off;
+  co->cRemap = 1;
+  return true;
+}
+
+static void co_remap_free_off(stStackMem_t* stack_mem, long off) {
+#if defined(__linux__)
+  fallocate(stack_mem->remap_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, stack_mem->stack_size);
+#endif
+  if (stack_mem->remap_free_count == stack_mem->remap_free_cap) {
+    stack_mem->remap_free_cap = stack_mem->remap_free_cap ? stack_mem->remap_free_cap * 2 : 16;
+    stack_mem->remap_free = (long*) realloc(stack_mem->remap_free, sizeof(long) * stack_mem->remap_free_cap);
+  }
+  stack_mem->remap_free[stack_mem->remap_free_count++] = off;
+}
+
+/**
+ * 协程释放/重置时归还后备页。它的页还映射在栈上时：
+ * - 栈上是别的协程(占用者)的内容，不能换掉，把这段后备页直接过户给占用者(占用者原来的后备页没有映射，可以归还)
+ * - 否则换回匿名页，避免这段偏移复用后两个协程共用同一批物理页
+ */
+static void co_remap_release(stCoRoutine_t* co) {
+  if (!co->cRemap) {
+    return;
+  }
+  stStackMem_t* stack_mem = co->stack_mem;
+  co->cRemap = 0;
+  co->cInBacking = 0;
+  if (stack_mem->remap_owner == co) {
+    stCoRoutine_t* occupy_co = stack_mem->occupy_co;
+    if (occupy_co && occupy_co != co) {
+      if (occupy_co->cRemap) {
+        co_remap_free_off(stack_mem, occupy_co->remap_off);
+      }
+      occupy_co->remap_off = co->remap_off;
+      occupy_co->cRemap = 1;
+      stack_mem->remap_owner = occupy_co;
+      return;
+    }
+    co_remap_window(co->env, stack_mem, NULL);
+  }
+  co_remap_free_off(stack_mem, co->remap_off);
+}
+
+/**
+ * 后备页没能映射上来时，co_swap 切换之后从 memfd 读回栈内容
+ */
+static void co_remap_read(stCoRoutine_t* co) {
+  stStackMem_t* stack_mem = co->stack_mem;
+  ssize_t ret = pread(stack_mem->remap_fd, co->stack_sp, co->save_size,
+                      co->remap_off + (co->stack_sp - stack_mem->stack_buffer));
+  (void) ret;
+}
+
+void save_stack_buffer(stCoRoutine_t* occupy_co);
+
+/**
+ * CO_STACK_REMAP 共享栈上的冲突切换(代替 save_stack_buffer)，在 curr 的栈上、coctx_swap 之前执行：
+ * - 换出 occupy_co：栈上映射的就是它的后备页时什么都不用拷，否则照常 memcpy 到 save_buffer
+ * - 换入 pending_co：内容在后备页里，或者栈够深(save_size 超过阈值)时，把它的后备页映射上来；
+ *   内容在 save_buffer 里的，coctx_swap 之后照常拷回(这次拷进的就是它的后备页，以后不用再拷)
+ * - 不走映射时，栈上不能留着别的协程的后备页(会被写坏)：换回匿名页，当前正运行在这块栈上没法换时，
+ *   先把那个协程的内容 memcpy 出来
+ */
+static void co_remap_switch(stCoRoutineEnv_t* env, stCoRoutine_t* curr, stCoRoutine_t* occupy_co,
+                            stCoRoutine_t* pending_co) {
+  stStackMem_t* stack_mem = pending_co->stack_mem;
+  bool can_remap = curr->stack_mem != stack_mem; // 不能换掉自己脚下的栈
+
+  if (occupy_co) {
+    if (stack_mem->remap_owner == occupy_co) {
+      occupy_co->save_size = stack_mem->stack_bp - occupy_co->stack_sp;
+      occupy_co->cInBacking = 1;
+    } else {
+      save_stack_buffer(occupy_co);
+      occupy_co->cInBacking = 0;
+    }
+  }
+
+  if (stack_mem->remap_owner == pending_co) { // 内容不在后备页里时(页被别人借用过)，切换后照常从 save_buffer 拷回
+    return;
+  }
+  bool deep = pending_co->cInBacking || (pending_co->cStart && pending_co->save_size >= gCoRemapThreshold);
+  if (deep && can_remap && co_remap_alloc(stack_mem, pending_co) && co_remap_window(env, stack_mem, pending_co)) {
+    return;
+  }
+
+  stCoRoutine_t* owner = stack_mem->remap_owner;
+  if (owner && !(can_remap && co_remap_window(env, stack_mem, NULL)) && owner->cInBacking) {
+    // 换不掉时 owner 的页借给 pending_co 用，owner 的内容先拷出来(只可能是刚换出的 occupy_co)
+    save_stack_buffer(owner);
+    owner->cInBacking = 0;
+  }
+}
+
 void save_stack_buffer(stCoRoutine_t* occupy_co) {
   /// copy out
+  stCoRoutineEnv_t* env = occupy_co->env;
   stStackMem_t* stack_mem = occupy_co->stack_mem;
-  int len = stack_mem->stack_bp - occupy_co->stack_sp;
+  unsigned int len = stack_mem->stack_bp - occupy_co->stack_sp;
+  size_t need = len + ((uintptr_t) occupy_co->stack_sp & kCoSaveAlignMask);
 
-  if (occupy_co->save_buffer) {
-    free(occupy_co->save_buffer), occupy_co->save_buffer = NULL;
+  if (occupy_co->save_buffer && need <= occupy_co->save_cap) { // 放得下：原地复用，不再 free + malloc
+    env->stat.save_buf_reuse++;
+  } else {
+    if (occupy_co->save_buffer) {
+      co_save_buf_put(env, occupy_co->save_buffer, occupy_co->save_cap);
+    }
+    occupy_co->save_buffer = co_save_buf_get(env, need, &occupy_co->save_cap);
   }
-
-  occupy_co->save_buffer = (char*) malloc(len); // malloc buf;
   occupy_co->save_size = len;
+  env->stat.share_copy_bytes += len;
+  stack_mem->save_bytes += len;
+  co_share_account(env, occupy_co, len);
 
-  memcpy(occupy_co->save_buffer, occupy_co->stack_sp, len);
+  memcpy(co_save_data(occupy_co), occupy_co->stack_sp, len);
 }
 
+static void co_wake(stCoRoutine_t* co);
+
+/**
+ * co_swap 的编译期策略：
+ * kCoSwapPrivate - 只有独享栈(__LIBCO_PRIVATE_STACK_ONLY__)，co_swap 只做寄存器切换，不读写 TLS env，
+ *                  co_create 忽略 attr->share_stack
+ * kCoSwapShared  - 只有共享栈(__LIBCO_SHARE_STACK_ONLY__)，省掉对 cIsShareStack 的判断
+ * kCoSwapMixed   - 默认，两种栈混用，每次切换按目标协程的 cIsShareStack 分支
+ */
+enum {
+  kCoSwapPrivate = 0,
+  kCoSwapShared = 1,
+  kCoSwapMixed = 2,
+};
+
+#if defined(__LIBCO_PRIVATE_STACK_ONLY__) && defined(__LIBCO_SHARE_STACK_ONLY__)
+#error "__LIBCO_PRIVATE_STACK_ONLY__ and __LIBCO_SHARE_STACK_ONLY__ are exclusive"
+#elif defined(__LIBCO_PRIVATE_STACK_ONLY__)
+static const int kCoSwapPolicy = kCoSwapPrivate;
+#elif defined(__LIBCO_SHARE_STACK_ONLY__)
+static const int kCoSwapPolicy = kCoSwapShared;
+#else
+static const int kCoSwapPolicy = kCoSwapMixed;
+#endif
+
 /**
  * - 切换协程上下文
  * 协程的切换都是通过内部调用co_swap()函数来完成，具体的切换过程分两种情况：（假设协程 co_from 切换到 co_to）
@@ -707,25 +2329,56 @@ void save_stack_buffer(stCoRoutine_t* occupy_co) {
  * @param curr 当前协程，co_from，有可能是
  * @param pending_co 下一个协程 co_to
  */
-void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co) {
-  stCoRoutineEnv_t* env = co_get_curr_thread_env(); // 当前thread中的所有协程数据(状态、信息)
-
+template <int kPolicy>
+static inline void co_swap_policy(stCoRoutine_t* curr, stCoRoutine_t* pending_co) {
   // get curr stack sp
   char c;
   curr->stack_sp = &c;
+#if defined(__aarch64__)
+  // AArch64 的帧记录(x29/x30)和被调用者保存寄存器在局部变量下面(帧的低地址端，x29 指向帧记录)。
+  // 共享栈换出/换入、休眠都只处理 [stack_sp, stack_bp)，要把它们也包含进去，
+  // 否则别的协程写过这块栈后，co_swap 返回时恢复的 x29/x30 是别人的数据
+  char* frame = (char*) __builtin_frame_address(0);
+  if (frame < curr->stack_sp) {
+    curr->stack_sp = frame;
+  }
+#endif
+  curr->cIdleScans = 0;
+  curr->cHibScans = 0;
+  if (pending_co->cHibernated) {
+    co_wake(pending_co);
+  }
+  co_set_curr_word(pending_co);
+
+  if (kPolicy == kCoSwapPrivate) { // 只有独享栈：只切寄存器，不碰 env 里的共享栈簿记
+    coctx_swap(&(curr->ctx), &(pending_co->ctx));
+    return;
+  }
+
+  stCoRoutineEnv_t* env = co_get_curr_thread_env(); // 当前thread中的所有协程数据(状态、信息)
 
-  if (!pending_co->cIsShareStack) { // 独享栈模式
+  if (curr->cPromote) {
+    co_promote_share_stack(env, curr);
+  }
+
+  if (kPolicy == kCoSwapMixed && !pending_co->cIsShareStack) { // 独享栈模式
     env->pending_co = NULL;
     env->occupy_co = NULL;
   } else { // 共享栈模式
+    // 独享栈协程走这里也是正确的：它的 stack_mem 只有自己会占用，occupy_co 只可能是 NULL 或它自己
     env->pending_co = pending_co;
+    pending_co->stack_mem->last_swap = ++env->share_swap_seq;
     // get last occupy co on the same stack mem
     stCoRoutine_t* occupy_co = pending_co->stack_mem->occupy_co;
     // set pending co to occupy thest stack mem;
     pending_co->stack_mem->occupy_co = pending_co;
 
     env->occupy_co = occupy_co;
-    if (occupy_co && occupy_co != pending_co) {
+    if (pending_co->stack_mem->alloc_flags & CO_STACK_REMAP) {
+      if (occupy_co != pending_co) {
+        co_remap_switch(env, curr, occupy_co, pending_co);
+      }
+    } else if (occupy_co && occupy_co != pending_co) {
       save_stack_buffer(occupy_co);
     }
   }
@@ -739,16 +2392,29 @@ void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co) {
   stCoRoutine_t* update_occupy_co = curr_env->occupy_co;
   stCoRoutine_t* update_pending_co = curr_env->pending_co;
 
-  if (update_occupy_co && update_pending_co && update_occupy_co != update_pending_co) {
+  // 上一个占用者被 co_free/co_reset 清掉时 occupy_co 为 NULL，这时 pending_co 保存的栈内容同样要拷回来
+  if (update_pending_co && update_occupy_co != update_pending_co) {
     // resume stack buffer
-    if (update_pending_co->save_buffer && update_pending_co->save_size > 0) {
+    if (update_pending_co->cInBacking) { // CO_STACK_REMAP：后备页已经映射上来了，或者没法映射时从 memfd 读回来
+      if (update_pending_co->stack_mem->remap_owner != update_pending_co) {
+        curr_env->stat.share_copy_bytes += update_pending_co->save_size;
+        co_remap_read(update_pending_co);
+      }
+      update_pending_co->cInBacking = 0;
+    } else if (update_pending_co->save_buffer && update_pending_co->save_size > 0) {
+      curr_env->stat.share_copy_bytes += update_pending_co->save_size;
+      co_share_account(curr_env, update_pending_co, update_pending_co->save_size);
       memcpy(update_pending_co->stack_sp, 
-             update_pending_co->save_buffer, 
+             co_save_data(update_pending_co), 
              update_pending_co->save_size);
     }
   }
 }
 
+void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co) {
+  co_swap_policy<kCoSwapPolicy>(curr, pending_co);
+}
+
 // int poll(struct pollfd fds[], nfds_t nfds, int timeout);
 // { fd,events,revents }
 struct stPollItem_t;
@@ -772,6 +2438,19 @@ struct stPollItem_t : public stTimeoutItem_t {
   struct epoll_event stEvent;
 };
 
+/**
+ * nfds 不超过 kInlineFds 时，co_poll_inner 的 stPoll_t 和两个数组一起从线程的 poll_slab 里分配。
+ * 共享栈协程切出去后栈上的内容会被覆盖，epoll 里登记的指针不能指向栈，所以不放在栈上
+ */
+struct stPollBlock_t {
+  enum {
+    kInlineFds = 4,
+  };
+  stPoll_t poll;
+  struct pollfd fds[kInlineFds];
+  stPollItem_t items[kInlineFds];
+};
+
 /**
  * EPOLLPRI 		POLLPRI    // There is urgent data to read.
  * EPOLLMSG 		POLLMSG
@@ -814,65 +2493,516 @@ static short EpollEvent2Poll(uint32_t events) {
   return e;
 }
 
-// __thread 表示线程私有变量
-// libco 的协程是 "单调用链"的，就是说一个线程内可以创建 N 个协程，协程总是由当前线程调用，一个线程只有一条调
-// 用链。libco 使用 stCoRoutineEnv_t 结构来记录当前的调用链。当前线程的调用链通过线程专有变量 
-// gCoEnvPerThread 来保存，libco 内部会在第一次使用协程的时候初始化这个变量，我们看到 
-// stCoRoutineEnv_t.pCallStack 的大小 128，这意味着，我们最多可以在协程嵌套 co_resume 新协程的深度为 
-// 128（协程里面运行新的协程）
-static __thread stCoRoutineEnv_t* gCoEnvPerThread = nullptr; // 表示每条线程中的协程上下文
+// __thread 表示线程私有变量
+// libco 的协程是 "单调用链"的，就是说一个线程内可以创建 N 个协程，协程总是由当前线程调用，一个线程只有一条调
+// 用链。libco 使用 stCoRoutineEnv_t 结构来记录当前的调用链。当前线程的调用链通过线程专有变量 
+// gCoEnvPerThread 来保存，libco 内部会在第一次使用协程的时候初始化这个变量，我们看到 
+// stCoRoutineEnv_t.pCallStack 的大小 128，这意味着，我们最多可以在协程嵌套 co_resume 新协程的深度为 
+// 128（协程里面运行新的协程）
+static __thread stCoRoutineEnv_t* gCoEnvPerThread = nullptr; // 表示每条线程中的协程上下文
+__thread uintptr_t gCoCurrWord __attribute__((tls_model("initial-exec"))) = 0;
+
+/**
+ * 初始化当前线程的协程环境
+ */
+void co_init_curr_thread_env() {
+  gCoEnvPerThread = (stCoRoutineEnv_t*) calloc(1, sizeof(stCoRoutineEnv_t));
+  stCoRoutineEnv_t* env = gCoEnvPerThread;
+
+  env->iCallStackSize = 0;
+  struct stCoRoutine_t* self = co_create_env(env, NULL, NULL, NULL);
+  self->cIsMain = 1; // 标识是一个main()函数的主协程
+
+  env->pending_co = NULL;
+  env->occupy_co = NULL;
+
+  coctx_init(&self->ctx);
+
+  env->pCallStack[env->iCallStackSize++] = self;
+  co_set_curr_word(self);
+
+  stCoEpoll_t* ev = AllocEpoll();
+  SetEpoll(env, ev);
+}
+
+/**
+ * 获取当前线程上下文，其中包括：该线程中的所有协程调用栈(栈帧)、epoll等
+ */
+stCoRoutineEnv_t* co_get_curr_thread_env() { 
+  return gCoEnvPerThread;
+}
+
+/**
+ * Poll处理事件
+ */
+void OnPollProcessEvent(stTimeoutItem_t* ap) {
+  stCoRoutine_t* co = (stCoRoutine_t*) ap->pArg; // 获取当前正在运行的协程对象实例
+  co_resume(co); // resume当前这个协程实例
+}
+
+void OnPollPreparePfn(stTimeoutItem_t* ap, struct epoll_event& e, stTimeoutItemLink_t* active) {
+  stPollItem_t* lp = (stPollItem_t*) ap;
+  lp->pSelf->revents = EpollEvent2Poll(e.events);
+
+  stPoll_t* pPoll = lp->pPoll;
+  pPoll->iRaiseCnt++;
+
+  if (!pPoll->iAllEventDetach) {
+    pPoll->iAllEventDetach = 1;
+
+    RemoveFromLink<stTimeoutItem_t, stTimeoutItemLink_t>(pPoll);
+
+    AddTail(active, pPoll);
+  }
+}
+
+/**
+ * 就绪项对应协程所在的共享栈，独享栈协程返回 NULL
+ */
+static stStackMem_t* co_item_share_stack(stTimeoutItem_t* item) {
+  stCoRoutine_t* co = (stCoRoutine_t*) item->pArg;
+  return co && co->cIsShareStack ? co->stack_mem : NULL;
+}
+
+/**
+ * 按给定顺序依次 resume 会有多少次共享栈冲突(目标协程不是栈的当前占用者，需要换出/换入)
+ */
+static int co_count_stack_conflicts(stTimeoutItem_t** items, int n) {
+  for (int i = 0; i < n; i++) {
+    stStackMem_t* stack_mem = co_item_share_stack(items[i]);
+    if (stack_mem) {
+      stack_mem->sched_occupy = stack_mem->occupy_co;
+    }
+  }
+  int conflicts = 0;
+  for (int i = 0; i < n; i++) {
+    stStackMem_t* stack_mem = co_item_share_stack(items[i]);
+    if (stack_mem && stack_mem->sched_occupy != items[i]->pArg) {
+      conflicts++;
+      stack_mem->sched_occupy = (stCoRoutine_t*) items[i]->pArg;
+    }
+  }
+  return conflicts;
+}
+
+/**
+ * 0: 独享栈或已经占着自己共享栈的协程，先运行；1: 需要换入的，按 stack_mem 分组
+ */
+static int co_item_stack_rank(stTimeoutItem_t* item) {
+  stStackMem_t* stack_mem = co_item_share_stack(item);
+  return stack_mem && stack_mem->occupy_co != item->pArg;
+}
+
+static bool co_item_stack_less(stTimeoutItem_t* a, stTimeoutItem_t* b) {
+  int rank_a = co_item_stack_rank(a);
+  int rank_b = co_item_stack_rank(b);
+  if (rank_a != rank_b) {
+    return rank_a < rank_b;
+  }
+  return rank_a && co_item_share_stack(a) < co_item_share_stack(b);
+}
+
+/**
+ * 重排本轮的就绪链表：占着共享栈的协程先运行，其余的按共享栈分组，同组内保持到达顺序
+ */
+static void co_group_active_by_stack(stCoEpoll_t* ctx, stTimeoutItemLink_t* active) {
+  int n = 0;
+  for (stTimeoutItem_t* lp = active->head; lp; lp = lp->pNext) {
+    n++;
+  }
+  if (n < 2) {
+    return;
+  }
+  if (n > ctx->group_cap) {
+    ctx->group_cap = n * 2;
+    ctx->group_items = (stTimeoutItem_t**) realloc(ctx->group_items, sizeof(stTimeoutItem_t*) * ctx->group_cap);
+  }
+  stTimeoutItem_t** items = ctx->group_items;
+  for (int i = 0; i < n; i++) {
+    items[i] = active->head;
+    PopHead<stTimeoutItem_t, stTimeoutItemLink_t>(active);
+  }
+
+  int before = co_count_stack_conflicts(items, n);
+  std::stable_sort(items, items + n, co_item_stack_less);
+  int after = co_count_stack_conflicts(items, n);
+
+  for (int i = 0; i < n; i++) {
+    AddTail(active, items[i]);
+  }
+
+  stCoStat_t* stat = &co_get_curr_thread_env()->stat;
+  stat->eventloop_conflicts += after;
+  stat->eventloop_conflicts_saved += before - after;
+  stat->eventloop_last_saved = before - after;
+}
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
 
 /**
- * 初始化当前线程的协程环境
+ * co_trim_stack 保留 stack_sp 以下的这么多字节：co_swap 剩下的局部变量和 coctx_swap 的返回地址还在 sp 下面
  */
-void co_init_curr_thread_env() {
-  gCoEnvPerThread = (stCoRoutineEnv_t*) calloc(1, sizeof(stCoRoutineEnv_t));
-  stCoRoutineEnv_t* env = gCoEnvPerThread;
+static const size_t kCoTrimMargin = 1024;
 
-  env->iCallStackSize = 0;
-  struct stCoRoutine_t* self = co_create_env(env, NULL, NULL, NULL);
-  self->cIsMain = 1; // 标识是一个main()函数的主协程
+static long co_trim_stack_env(stCoRoutineEnv_t* env, stCoRoutine_t* co) {
+  if (!co->cStart || co->cIsMain || co == GetCurrCo(env)) {
+    return -1;
+  }
+  stStackMem_t* stack_mem = co->stack_mem;
+  // 共享栈上不是自己的内容(已经换出到 save_buffer)时没有可回收的
+  if (!stack_mem || (co->cIsShareStack && stack_mem->occupy_co != co)) {
+    return 0;
+  }
 
-  env->pending_co = NULL;
-  env->occupy_co = NULL;
+  size_t page = co_page_size();
+  uintptr_t begin = ((uintptr_t) stack_mem->stack_buffer + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t) co->stack_sp - kCoTrimMargin) & ~(page - 1);
+  if (end <= begin) {
+    return 0;
+  }
 
-  coctx_init(&self->ctx);
+  int advice = env->idle_trim_advice ? env->idle_trim_advice : MADV_DONTNEED;
+  if (madvise((void*) begin, end - begin, advice) != 0) {
+    if (advice != MADV_FREE || madvise((void*) begin, end - begin, MADV_DONTNEED) != 0) {
+      co_log_err("CO_ERR: co_trim_stack madvise errno %d", errno);
+      return -1;
+    }
+    env->idle_trim_advice = MADV_DONTNEED; // 内核不支持 MADV_FREE
+  }
+  // 可增长的栈顺便把提交区域缩回 sp 附近，之后再用到时重新扩展
+  if ((stack_mem->alloc_flags & CO_STACK_GROWABLE) && (char*) end > stack_mem->commit_low &&
+      mprotect(stack_mem->commit_low, (char*) end - stack_mem->commit_low, PROT_NONE) == 0) {
+    stack_mem->commit_low = (char*) end;
+  }
+  env->stat.stack_trim_count++;
+  env->stat.stack_trim_bytes += end - begin;
+  return end - begin;
+}
 
-  env->pCallStack[env->iCallStackSize++] = self;
+long co_trim_stack(stCoRoutine_t* co) {
+  return co_trim_stack_env(co->env, co);
+}
 
-  stCoEpoll_t* ev = AllocEpoll();
-  SetEpoll(env, ev);
+void co_set_idle_trim(unsigned int idle_ms, int advice) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  env->idle_trim_ms = idle_ms;
+  env->idle_trim_advice = advice;
 }
 
 /**
- * 获取当前线程上下文，其中包括：该线程中的所有协程调用栈(栈帧)、epoll等
+ * 第一次扫描到时 cIdleScans 记为1，下一次扫描还没被切换过(仍为1)说明已经挂起了至少 idle_trim_ms，回收一次；
+ * 之后不再重复 madvise，直到它再次运行
  */
-stCoRoutineEnv_t* co_get_curr_thread_env() { 
-  return gCoEnvPerThread;
+static void co_idle_trim_scan(stCoRoutineEnv_t* env) {
+  for (stCoRoutine_t* co = env->pCoList; co; co = co->pNextCo) {
+    if (co->cIdleScans < 2 && ++co->cIdleScans == 2) {
+      co_trim_stack_env(env, co);
+    }
+  }
 }
 
 /**
- * Poll处理事件
+ * 栈内容的 LZ 压缩(LZF 的格式)：控制字节 c < 32 时后面跟 c + 1 个原样的字节；
+ * 否则是一段回溯匹配，长度 (c >> 5) + 2(为 7 时再加下一个字节)，距离 ((c & 31) << 8 | 下一个字节) + 1。
+ * 栈上多是清零的缓冲区和重复的指针，够用了
  */
-void OnPollProcessEvent(stTimeoutItem_t* ap) {
-  stCoRoutine_t* co = (stCoRoutine_t*) ap->pArg; // 获取当前正在运行的协程对象实例
-  co_resume(co); // resume当前这个协程实例
+static const unsigned int kCoLzHashBits = 12;
+static const unsigned int kCoLzMaxOff = 1 << 13;
+static const unsigned int kCoLzMaxLen = 264;
+
+static inline unsigned int co_lz_hash(const unsigned char* p) {
+  unsigned int v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - kCoLzHashBits);
 }
 
-void OnPollPreparePfn(stTimeoutItem_t* ap, struct epoll_event& e, stTimeoutItemLink_t* active) {
-  stPollItem_t* lp = (stPollItem_t*) ap;
-  lp->pSelf->revents = EpollEvent2Poll(e.events);
+/**
+ * 返回压缩后的长度，out 至少要有 len + len / 32 + 1 字节
+ */
+static unsigned int co_lz_compress(const unsigned char* in, unsigned int len, unsigned char* out,
+                                   unsigned int* table) {
+  memset(table, 0, sizeof(unsigned int) << kCoLzHashBits);
+  unsigned int ip = 0;
+  unsigned int op = 0;
+  unsigned int lit_ctrl = 0;
+  unsigned int lit = 0;
+  while (ip < len) {
+    if (ip + 2 < len) {
+      unsigned int* slot = &table[co_lz_hash(in + ip)];
+      unsigned int ref = *slot; // 存的是位置 + 1，0 表示空
+      *slot = ip + 1;
+      if (ref && ip - ref < kCoLzMaxOff && !memcmp(in + ref - 1, in + ip, 3)) {
+        ref--;
+        unsigned int m = 3;
+        while (ip + m < len && m < kCoLzMaxLen && in[ref + m] == in[ip + m]) {
+          m++;
+        }
+        if (lit) {
+          out[lit_ctrl] = lit - 1;
+          lit = 0;
+        }
+        unsigned int off = ip - ref - 1;
+        unsigned int l = m - 2;
+        if (l < 7) {
+          out[op++] = (l << 5) | (off >> 8);
+        } else {
+          out[op++] = (7 << 5) | (off >> 8);
+          out[op++] = l - 7;
+        }
+        out[op++] = off & 0xff;
+        ip += m;
+        if (ip + 2 < len) {
+          table[co_lz_hash(in + ip - 1)] = ip; // 匹配末尾也登记一下，连续的零能接着匹配
+        }
+        continue;
+      }
+    }
+    if (!lit) {
+      lit_ctrl = op++;
+    }
+    out[op++] = in[ip++];
+    if (++lit == 32) {
+      out[lit_ctrl] = 31;
+      lit = 0;
+    }
+  }
+  if (lit) {
+    out[lit_ctrl] = lit - 1;
+  }
+  return op;
+}
 
-  stPoll_t* pPoll = lp->pPoll;
-  pPoll->iRaiseCnt++;
+static void co_lz_decompress(const unsigned char* in, unsigned int len, unsigned char* out) {
+  unsigned int ip = 0;
+  unsigned char* op = out;
+  while (ip < len) {
+    unsigned int c = in[ip++];
+    if (c < 32) {
+      memcpy(op, in + ip, c + 1);
+      ip += c + 1;
+      op += c + 1;
+      continue;
+    }
+    unsigned int l = c >> 5;
+    if (l == 7) {
+      l += in[ip++];
+    }
+    l += 2;
+    const unsigned char* ref = op - (((c & 31) << 8) | in[ip++]) - 1;
+    while (l--) { // 可能重叠(距离小于长度)，逐字节拷贝
+      *op++ = *ref++;
+    }
+  }
+}
 
-  if (!pPoll->iAllEventDetach) {
-    pPoll->iAllEventDetach = 1;
+static char* co_hib_alloc(stCoRoutineEnv_t* env, unsigned int len, stCoHibChunk_t** chunk_out) {
+  stCoHibSlab_t* slab = &env->hib_slab;
+  stCoHibChunk_t* chunk = slab->curr;
+  if (!chunk || chunk->used + len > chunk->size) {
+    bool dedicated = len > stCoHibSlab_t::kChunkSize / 4;
+    unsigned int size = dedicated ? len : stCoHibSlab_t::kChunkSize;
+    // 直接 mmap，不和协程、save_buffer 混在 malloc 的堆里，整块释放时内存能真正还给内核
+    size_t page = co_page_size();
+    size = (sizeof(stCoHibChunk_t) + size + page - 1) / page * page - sizeof(stCoHibChunk_t);
+    chunk = (stCoHibChunk_t*) mmap(NULL, sizeof(stCoHibChunk_t) + size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+      return NULL;
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->live = 0;
+    chunk->pPrev = NULL;
+    chunk->pNext = slab->chunks;
+    if (slab->chunks) {
+      slab->chunks->pPrev = chunk;
+    }
+    slab->chunks = chunk;
+    env->stat.hibernate_slab_bytes += size;
+    if (!dedicated) {
+      slab->curr = chunk;
+    }
+  }
+  char* data = (char*) (chunk + 1) + chunk->used;
+  chunk->used += (len + 7) & ~7U;
+  if (chunk->used > chunk->size) {
+    chunk->used = chunk->size;
+  }
+  chunk->live += len;
+  *chunk_out = chunk;
+  return data;
+}
 
-    RemoveFromLink<stTimeoutItem_t, stTimeoutItemLink_t>(pPoll);
+static void co_hib_free(stCoRoutineEnv_t* env, stCoHibChunk_t* chunk, unsigned int len) {
+  stCoHibSlab_t* slab = &env->hib_slab;
+  chunk->live -= len;
+  if (chunk->live) {
+    return;
+  }
+  if (chunk == slab->curr) {
+    chunk->used = 0;
+    return;
+  }
+  if (chunk->pPrev) {
+    chunk->pPrev->pNext = chunk->pNext;
+  } else {
+    slab->chunks = chunk->pNext;
+  }
+  if (chunk->pNext) {
+    chunk->pNext->pPrev = chunk->pPrev;
+  }
+  env->stat.hibernate_slab_bytes -= chunk->size;
+  munmap(chunk, sizeof(stCoHibChunk_t) + chunk->size);
+}
 
-    AddTail(active, pPoll);
+static void co_hib_release(stCoRoutine_t* co) {
+  if (!co->cHibernated) {
+    return;
+  }
+  stCoRoutineEnv_t* env = co->env;
+  co_hib_free(env, co->hib_chunk, co->hib_len);
+  env->stat.hibernate_raw_bytes -= co->stack_mem->stack_bp - co->stack_sp;
+  env->stat.hibernate_stored_bytes -= co->hib_len;
+  co->cHibernated = 0;
+  co->hib_chunk = NULL;
+  co->hib_data = NULL;
+  co->hib_len = 0;
+}
+
+long co_hibernate(stCoRoutine_t* co, int flags) {
+  stCoRoutineEnv_t* env = co->env;
+  if (!co->cStart || co->cEnd || co->cIsMain || co->cInBacking) {
+    return -1;
+  }
+  if (co->cHibernated) {
+    return co->hib_len;
+  }
+  for (int i = 0; i < env->iCallStackSize; i++) {
+    if (env->pCallStack[i] == co) {
+      return -1;
+    }
+  }
+
+  stStackMem_t* stack_mem = co->stack_mem;
+  unsigned int len = stack_mem->stack_bp - co->stack_sp;
+  // 栈内容现在在哪：独享栈和共享栈的占用者在栈上，其他共享栈协程在 save_buffer 里
+  const unsigned char* src = (const unsigned char*) co->stack_sp;
+  if (co->cIsShareStack && stack_mem->occupy_co != co) {
+    if (!co->save_buffer) {
+      return -1;
+    }
+    src = (const unsigned char*) co_save_data(co);
+  }
+  if (co->cStackPainted) { // 独享栈的页要还回去，剖析到此为止
+    co_stack_profile_record(env, co);
+    co->cStackPainted = 0;
+  }
+
+  const unsigned char* data = src;
+  unsigned int stored = len;
+  co->cHibCompressed = 0;
+  if ((flags & CO_HIBERNATE_COMPRESS) && len > 64) {
+    stCoHibSlab_t* slab = &env->hib_slab;
+    unsigned int need = len + len / 32 + 1;
+    if (slab->scratch_cap < need) {
+      free(slab->scratch);
+      slab->scratch = (unsigned char*) malloc(need);
+      slab->scratch_cap = need;
+    }
+    if (!slab->lz_table) {
+      slab->lz_table = (unsigned int*) malloc(sizeof(unsigned int) << kCoLzHashBits);
+    }
+    unsigned int clen = co_lz_compress(src, len, slab->scratch, slab->lz_table);
+    if (clen < len) {
+      data = slab->scratch;
+      stored = clen;
+      co->cHibCompressed = 1;
+    }
+  }
+  co->hib_data = co_hib_alloc(env, stored, &co->hib_chunk);
+  if (!co->hib_data) {
+    return -1;
+  }
+  memcpy(co->hib_data, data, stored);
+  co->hib_len = stored;
+  co->cHibernated = 1;
+
+  if (co->cIsShareStack) {
+    co_release_save_buffer(co);
+    co->save_size = len;
+    if (stack_mem->occupy_co == co) { // 共享栈上的内容已经搬走，下一个协程换入时不用再换出它
+      stack_mem->occupy_co = NULL;
+    }
+  } else {
+    size_t page = co_page_size();
+    uintptr_t begin = ((uintptr_t) stack_mem->stack_buffer + page - 1) & ~(page - 1);
+    uintptr_t end = (uintptr_t) stack_mem->stack_bp & ~(page - 1);
+    if (end > begin) {
+      madvise((void*) begin, end - begin, MADV_DONTNEED);
+    }
+  }
+
+  env->stat.hibernate_count++;
+  env->stat.hibernate_raw_bytes += len;
+  env->stat.hibernate_stored_bytes += stored;
+  return stored;
+}
+
+/**
+ * co_swap 切换到休眠的协程之前调用(还在 curr 的栈上)：独享栈直接写回栈上，
+ * 共享栈协程恢复到 save_buffer，之后按普通的换入拷回共享栈
+ */
+static void co_wake(stCoRoutine_t* co) {
+  stCoRoutineEnv_t* env = co->env;
+  stStackMem_t* stack_mem = co->stack_mem;
+  unsigned int len = stack_mem->stack_bp - co->stack_sp;
+  char* dst = co->stack_sp;
+  if (co->cIsShareStack) {
+    co->save_buffer = co_save_buf_get(env, len + ((uintptr_t) co->stack_sp & kCoSaveAlignMask), &co->save_cap);
+    co->save_size = len;
+    dst = co_save_data(co);
+  }
+  if (co->cHibCompressed) {
+    co_lz_decompress((const unsigned char*) co->hib_data, co->hib_len, (unsigned char*) dst);
+  } else {
+    memcpy(dst, co->hib_data, len);
+  }
+  env->stat.hibernate_wake++;
+  co_hib_release(co);
+}
+
+void co_set_hibernate(unsigned int idle_ms, int flags) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  env->hibernate_ms = idle_ms;
+  env->hibernate_flags = flags;
+}
+
+/**
+ * 同 co_idle_trim_scan 的二次机会：连续两次扫描之间没有运行过的协程休眠
+ */
+static void co_hibernate_scan(stCoRoutineEnv_t* env) {
+  unsigned long long count = env->stat.hibernate_count;
+  for (stCoRoutine_t* co = env->pCoList; co; co = co->pNextCo) {
+    if (co->cHibScans < 2 && ++co->cHibScans == 2) {
+      co_hibernate(co, env->hibernate_flags);
+    }
+  }
+#if defined(__GLIBC__)
+  if (env->stat.hibernate_count != count) { // 归还的 save_buffer 在堆中间，不 trim 的话 RSS 降不下来
+    malloc_trim(0);
   }
+#endif
+}
+
+void co_eventloop_set_stack_grouping(stCoEpoll_t* ctx, int enable) {
+  ctx->group_by_stack = enable;
 }
 
 /**
@@ -913,6 +3043,10 @@ void co_eventloop(stCoEpoll_t* ctx, pfn_co_eventloop_t pfn, void* arg) {
 
     Join<stTimeoutItem_t, stTimeoutItemLink_t>(active, timeout);
 
+    if (ctx->group_by_stack) {
+      co_group_active_by_stack(ctx, active);
+    }
+
     lp = active->head;
     while (lp) {
       PopHead<stTimeoutItem_t, stTimeoutItemLink_t>(active);
@@ -930,6 +3064,16 @@ void co_eventloop(stCoEpoll_t* ctx, pfn_co_eventloop_t pfn, void* arg) {
 
       lp = active->head;
     }
+    stCoRoutineEnv_t* env = co_get_curr_thread_env();
+    if (env->idle_trim_ms && now >= env->idle_trim_last + env->idle_trim_ms) {
+      env->idle_trim_last = now;
+      co_idle_trim_scan(env);
+    }
+    if (env->hibernate_ms && now >= env->hibernate_last + env->hibernate_ms) {
+      env->hibernate_last = now;
+      co_hibernate_scan(env);
+    }
+
     if (pfn) {
       if (-1 == pfn(arg)) {
         break;
@@ -976,11 +3120,7 @@ stCoRoutine_t* GetCurrCo(stCoRoutineEnv_t* env) {
  * 获取当前thread中所有的co-routin
  */
 stCoRoutine_t* GetCurrThreadCo() {
-  stCoRoutineEnv_t* env = co_get_curr_thread_env();
-  if (!env) {
-    return 0;
-  }
-  return GetCurrCo(env);
+  return co_self_fast(); // 线程环境未初始化时为 0
 }
 
 typedef int (*poll_pfn_t) (struct pollfd fds[], nfds_t nfds, int timeout);
@@ -988,6 +3128,16 @@ typedef int (*poll_pfn_t) (struct pollfd fds[], nfds_t nfds, int timeout);
 /**
  * @param pollfunc 系统调用poll()
  */
+static void co_poll_free(stCoRoutineEnv_t* env, stPollBlock_t* block, stPoll_t* arg) {
+  if (block) {
+    co_slab_free(&env->poll_slab, block);
+    return;
+  }
+  free(arg->pPollItems);
+  free(arg->fds);
+  free(arg);
+}
+
 int co_poll_inner(stCoEpoll_t* ctx, 
                   struct pollfd fds[], nfds_t nfds, 
                   int timeout, poll_pfn_t pollfunc) {
@@ -1002,18 +3152,22 @@ int co_poll_inner(stCoEpoll_t* ctx,
   stCoRoutine_t* self = co_self(); // 获取当前需要执行的协程实例
 
   // 1.struct change
-  stPoll_t& arg = *((stPoll_t*) malloc(sizeof(stPoll_t)));
+  stCoRoutineEnv_t* env = self->env;
+  stPollBlock_t* block = NULL;
+  if (nfds <= stPollBlock_t::kInlineFds) {
+    block = (stPollBlock_t*) co_slab_alloc(&env->poll_slab, sizeof(stPollBlock_t));
+  }
+  stPoll_t& arg = block ? block->poll : *((stPoll_t*) malloc(sizeof(stPoll_t)));
   memset(&arg, 0, sizeof(arg));
 
   arg.iEpollFd = epfd;
-  arg.fds = (pollfd*) calloc(nfds, sizeof(pollfd));
   arg.nfds = nfds;
-
-  stPollItem_t arr[2];
-  if (nfds < sizeof(arr) / sizeof(arr[0]) && !self->cIsShareStack) {
-    // 意思是：只有一个fd需要poll 且 当前协程是独享栈模式
-    arg.pPollItems = arr; // nfds < 2 && 没有使用共享栈，
+  if (block) {
+    arg.fds = block->fds;
+    arg.pPollItems = block->items;
+    memset(arg.fds, 0, nfds * sizeof(pollfd));
   } else {
+    arg.fds = (pollfd*) calloc(nfds, sizeof(pollfd));
     arg.pPollItems = (stPollItem_t*) malloc(nfds * sizeof(stPollItem_t));
   }
   memset(arg.pPollItems, 0, nfds * sizeof(stPollItem_t));
@@ -1035,12 +3189,7 @@ int co_poll_inner(stCoEpoll_t* ctx,
 
       int ret = co_epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev);
       if (ret < 0 && errno == EPERM && nfds == 1 && pollfunc != NULL) {
-        if (arg.pPollItems != arr) {
-          free(arg.pPollItems);
-          arg.pPollItems = NULL;
-        }
-        free(arg.fds);
-        free(&arg);
+        co_poll_free(env, block, &arg);
         return pollfunc(fds, nfds, timeout);
       }
     }
@@ -1076,13 +3225,7 @@ int co_poll_inner(stCoEpoll_t* ctx,
       fds[i].revents = arg.fds[i].revents;
     }
 
-    if (arg.pPollItems != arr) {
-      free(arg.pPollItems);
-      arg.pPollItems = NULL;
-    }
-
-    free(arg.fds);
-    free(&arg);
+    co_poll_free(env, block, &arg);
   }
 
   return iRaiseCnt;
@@ -1120,7 +3263,12 @@ void* co_getspecific(pthread_key_t key) {
   if (!co || co->cIsMain) {
     return pthread_getspecific(key);
   }
-  return co->aSpec[key].value;
+  for (int i = 0; i < stCoRoutine_t::kInlineSpec; i++) {
+    if (co->aSpecKey[i] == key + 1) {
+      return co->aSpecValue[i];
+    }
+  }
+  return co->pSpecTable && key < stCoRoutine_t::kSpecTableSize ? co->pSpecTable[key].value : NULL;
 }
 
 /**
@@ -1131,7 +3279,32 @@ int co_setspecific(pthread_key_t key, const void* value) {
   if (!co || co->cIsMain) {
     return pthread_setspecific(key, value);
   }
-  co->aSpec[key].value = (void*) value; // 存储在当前协程的私有变量中
+  if (key >= stCoRoutine_t::kSpecTableSize) {
+    return EINVAL;
+  }
+  // 存储在当前协程的私有变量中：已有的 key 原地更新，新 key 先占对象里的空位，满了再用整表
+  int free_slot = -1;
+  for (int i = 0; i < stCoRoutine_t::kInlineSpec; i++) {
+    if (co->aSpecKey[i] == key + 1) {
+      co->aSpecValue[i] = (void*) value;
+      return 0;
+    }
+    if (!co->aSpecKey[i] && free_slot < 0) {
+      free_slot = i;
+    }
+  }
+  if (!co->pSpecTable && free_slot >= 0) {
+    co->aSpecKey[free_slot] = key + 1;
+    co->aSpecValue[free_slot] = (void*) value;
+    return 0;
+  }
+  if (!co->pSpecTable) {
+    co->pSpecTable = (stCoSpec_t*) calloc(stCoRoutine_t::kSpecTableSize, sizeof(stCoSpec_t));
+    if (!co->pSpecTable) {
+      return ENOMEM;
+    }
+  }
+  co->pSpecTable[key].value = (void*) value;
   return 0;
 }
 
@@ -1139,6 +3312,7 @@ void co_disable_hook_sys() {
   stCoRoutine_t* co = GetCurrThreadCo();
   if (co) {
     co->cEnableSysHook = 0;
+    co_set_curr_word(co);
   }
 }
 
@@ -1146,8 +3320,7 @@ void co_disable_hook_sys() {
  * 当前线程是否开启了Linux系统调用的hook机制？
  */
 bool co_is_enable_sys_hook() {
-  stCoRoutine_t* co = GetCurrThreadCo();
-  return (co && co->cEnableSysHook);
+  return co_is_enable_sys_hook_fast();
 }
 
 /**
@@ -1157,6 +3330,181 @@ stCoRoutine_t* co_self() {
   return GetCurrThreadCo(); 
 }
 
+/**
+ * 配置当前线程的独享栈回收池，见 co_routine.h
+ */
+void co_set_stack_pool(size_t high_watermark, size_t low_watermark, int lazy_alloc) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (low_watermark > high_watermark) {
+    low_watermark = high_watermark;
+  }
+  env->stack_pool.high_watermark = high_watermark;
+  env->stack_pool.low_watermark = low_watermark;
+  env->stack_pool.lazy_alloc = lazy_alloc;
+  if (env->stack_pool.cached_bytes > high_watermark) {
+    co_stack_pool_trim(env, low_watermark);
+  }
+}
+
+void co_get_stat(stCoStat_t* stat) {
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (!env) {
+    memset(stat, 0, sizeof(*stat));
+    return;
+  }
+  *stat = env->stat;
+  stat->stack_pool_bytes = env->stack_pool.cached_bytes;
+  stat->reuse_parked = env->reuse_count;
+  stat->arena_cached_bytes = (unsigned long long) env->arena_pool.count * stCoArenaPool_t::kChunkSize;
+}
+
+/**
+ * 配置当前线程的协程复用链表，见 co_routine.h
+ */
+void co_set_reuse_pool(unsigned int max_parked) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  env->reuse_max = max_parked;
+  co_reuse_trim(env, max_parked);
+}
+
+static void co_numa_add_range(std::vector<void*>& pages, const char* begin, const char* end) {
+  size_t page = co_page_size();
+  for (uintptr_t p = (uintptr_t) begin & ~(page - 1); p < (uintptr_t) end; p += page) {
+    pages.push_back((void*) p);
+  }
+}
+
+/**
+ * 用 move_pages(nodes 为 NULL 时只查询不迁移)取每页所在的节点，计入 counts；没分配的页不计
+ */
+static int co_numa_count_pages(std::vector<void*>& pages, unsigned long long* counts, int node,
+                               stCoNumaStat_t* stat) {
+#if defined(__linux__) && defined(SYS_move_pages)
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+  const size_t kBatch = 512;
+  int status[kBatch];
+  for (size_t i = 0; i < pages.size(); i += kBatch) {
+    size_t n = std::min(kBatch, pages.size() - i);
+    if (syscall(SYS_move_pages, 0, n, &pages[i], NULL, status, 0) != 0) {
+      return -1;
+    }
+    for (size_t j = 0; j < n; j++) {
+      if (status[j] < 0) {
+        continue;
+      }
+      if (status[j] < CO_NUMA_MAX_NODES) {
+        counts[status[j]]++;
+      }
+      if (status[j] == node) {
+        stat->local_pages++;
+      } else {
+        stat->remote_pages++;
+      }
+    }
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+int co_get_numa_stat(stCoNumaStat_t* stat) {
+  memset(stat, 0, sizeof(*stat));
+  stat->node = co_numa_node();
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (!env) {
+    return 0;
+  }
+
+  std::vector<stStackMem_t*> stacks;
+  std::vector<void*> co_pages;
+  for (stCoRoutine_t* co = env->pCoList; co; co = co->pNextCo) {
+    if (co->stack_mem && !co->cIsMain) {
+      stacks.push_back(co->stack_mem);
+    }
+    co_numa_add_range(co_pages, (const char*) co, (const char*) (co + 1));
+  }
+  std::sort(stacks.begin(), stacks.end()); // 共享栈会被多个协程引用
+  stacks.erase(std::unique(stacks.begin(), stacks.end()), stacks.end());
+  std::vector<void*> stack_pages;
+  for (size_t i = 0; i < stacks.size(); i++) {
+    co_numa_add_range(stack_pages, stacks[i]->stack_buffer, stacks[i]->stack_bp);
+  }
+
+  if (co_numa_count_pages(stack_pages, stat->stack_pages, stat->node, stat) != 0 ||
+      co_numa_count_pages(co_pages, stat->co_pages, stat->node, stat) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+void co_set_stack_profile(int enable) {
+  if (!co_get_curr_thread_env()) {
+    co_init_curr_thread_env();
+  }
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (!env->stack_profile) {
+    env->stack_profile = (stCoStackProfileTable_t*) calloc(1, sizeof(stCoStackProfileTable_t));
+  }
+  env->stack_profile->enable = enable;
+}
+
+void co_stack_profile_sample() {
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (!env) {
+    return;
+  }
+  for (stCoRoutine_t* co = env->pCoList; co; co = co->pNextCo) {
+    if (co->cStackPainted && !co->cEnd && co != GetCurrCo(env)) {
+      co_stack_profile_record(env, co);
+    }
+  }
+}
+
+int co_get_stack_profile(stCoStackProfile_t* profiles, int max_count) {
+  stCoRoutineEnv_t* env = co_get_curr_thread_env();
+  if (!env || !env->stack_profile) {
+    return 0;
+  }
+  stCoStackProfileTable_t* table = env->stack_profile;
+  size_t page = co_page_size();
+  int n = 0;
+  for (; n < table->count && n < max_count; n++) {
+    stCoStackProfileEntry_t* entry = &table->entries[n];
+    stCoStackProfile_t* profile = &profiles[n];
+    profile->pfn = entry->pfn;
+    profile->samples = entry->samples;
+    profile->stack_size = entry->stack_size;
+    profile->max_used = entry->max_used;
+    profile->avg_used = entry->samples ? entry->total_used / entry->samples : 0;
+    profile->recommended = (entry->max_used + entry->max_used / 2 + page - 1) & ~(page - 1);
+  }
+  return n;
+}
+
+void co_dump_stack_profile(int fd) {
+  stCoStackProfile_t profiles[stCoStackProfileTable_t::kMaxEntries];
+  int n = co_get_stack_profile(profiles, stCoStackProfileTable_t::kMaxEntries);
+  dprintf(fd, "%-18s %-32s %10s %10s %10s %10s %12s\n", "pfn", "symbol", "samples", "stack", "max_used",
+          "avg_used", "recommended");
+  for (int i = 0; i < n; i++) {
+    Dl_info info;
+    const char* name = "?";
+    if (dladdr((void*) profiles[i].pfn, &info) && info.dli_sname) {
+      name = info.dli_sname;
+    }
+    dprintf(fd, "%-18p %-32s %10llu %10u %10u %10u %12u\n", (void*) profiles[i].pfn, name, profiles[i].samples,
+            profiles[i].stack_size, profiles[i].max_used, profiles[i].avg_used, profiles[i].recommended);
+  }
+}
+
 // co cond
 struct stCoCond_t;
 
@@ -1206,7 +3554,9 @@ int co_cond_broadcast(stCoCond_t* si) {
 }
 
 int co_cond_timedwait(stCoCond_t* link, int ms) {
-  stCoCondItem_t* psi = (stCoCondItem_t*) calloc(1, sizeof(stCoCondItem_t));
+  stCoSlab_t* slab = &co_get_curr_thread_env()->cond_slab;
+  stCoCondItem_t* psi = (stCoCondItem_t*) co_slab_alloc(slab, sizeof(stCoCondItem_t));
+  memset(psi, 0, sizeof(*psi));
   psi->timeout.pArg = GetCurrThreadCo();
   psi->timeout.pfnProcess = OnSignalProcessEvent;
 
@@ -1216,7 +3566,7 @@ int co_cond_timedwait(stCoCond_t* link, int ms) {
 
     int ret = AddTimeout(co_get_curr_thread_env()->pEpoll->pTimeout, &psi->timeout, now);
     if (ret != 0) {
-      free(psi);
+      co_slab_free(slab, psi);
       return ret;
     }
   }
@@ -1225,7 +3575,7 @@ int co_cond_timedwait(stCoCond_t* link, int ms) {
   co_yield_ct();
 
   RemoveFromLink<stCoCondItem_t, stCoCond_t>(psi);
-  free(psi);
+  co_slab_free(slab, psi);
 
   return 0;
 }
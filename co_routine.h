@@ -88,16 +88,40 @@ available.
 struct stCoRoutine_t;
 struct stShareStack_t;
 
+/**
+ * 协程栈的分配方式(stCoRoutineAttr_t::stack_flags)，可以按位组合
+ */
+enum {
+  // mmap 分配栈(MAP_NORESERVE)：物理页在第一次访问时才提交，RSS 跟随实际栈深度；
+  // 栈底(低地址)下方加一个 PROT_NONE 的保护页，栈溢出立即 SIGSEGV 而不是悄悄写坏相邻内存
+  CO_STACK_MMAP = 1 << 0,
+  // 仅用于 co_alloc_sharestack_ex：一组共享栈从同一块 2MB 大页映射里切出来(先试 MAP_HUGETLB，再试透明大页
+  // madvise(MADV_HUGEPAGE))，各个栈的栈顶集中在少数几个大页里，减少切换和拷贝栈时的 dTLB miss
+  CO_STACK_HUGEPAGE = 1 << 1,
+  // 可增长的栈(隐含 CO_STACK_MMAP)：stack_size 作为上限只保留地址空间，先提交栈顶的 8K，其余为 PROT_NONE；
+  // 访问到未提交的部分时，SIGSEGV 处理函数(在 sigaltstack 上运行)把提交区域向下扩展后继续执行，
+  // 超过上限碰到最下面的保护页时输出 "libco: coroutine stack overflow" 并按默认方式崩溃。
+  // 进程里已有的 SIGSEGV 处理函数会被保留，不是可增长栈的缺页仍然交给它
+  CO_STACK_GROWABLE = 1 << 2,
+  // 仅用于共享栈(co_alloc_sharestack_ex)，只在 Linux 上有效：栈深度超过 co_set_share_remap_threshold() 的协程
+  // 在 memfd 里有自己的后备页，换出/换入时用 mmap(MAP_FIXED) 把它的后备页映射到共享栈的地址上，不再 memcpy
+  CO_STACK_REMAP = 1 << 3,
+  // Linux：栈内存 mbind 到分配时调用线程所在的 NUMA 节点(隐含 CO_STACK_MMAP)，共享栈还会预先触碰所有页
+  CO_STACK_NUMA = 1 << 4,
+};
+
 /**
  * 协程属性：共享栈 or 独享栈？栈大小
  */
 struct stCoRoutineAttr_t {
   int stack_size; // 所有协程的共享栈条数 128K
   stShareStack_t* share_stack; // 所有协程的共享栈
+  int stack_flags; // CO_STACK_*，独享栈的分配方式
 
   stCoRoutineAttr_t() {
     stack_size = 128 * 1024; // 独享栈模式，每个创建的协程都会在堆上分配一块默认128K的内存作为自己的栈帧空间
     share_stack = NULL;
+    stack_flags = 0;
   }
 } __attribute__((packed));
 // _attribute__ ((packed)) 的作用就是告诉编译器取消结构在编译过程中的优化对齐，按照实际占用字节数进行对齐，
@@ -110,6 +134,14 @@ typedef void* (*pfn_co_routine_t) (void*);
 // 2.co_routine
 // 协程生命周期开始：co_create()指定协程入口函数并创建协程，co_resume 将其唤醒，开始执行当前协程。
 int co_create(stCoRoutine_t** co, const stCoRoutineAttr_t* attr, void* (*routine) (void*), void* arg);
+// 批量创建 n 个协程，第 i 个的参数为 args[i](args 为 NULL 时都是 NULL)，结果写入 co[0..n)：
+// 协程对象和独享栈各从一块连续的 mmap 内存切分，独享栈协程的入口上下文也在这里一起构造好(栈只碰到栈顶)。
+// flags 为 CO_BATCH_POPULATE 时协程对象那块内存用 MAP_POPULATE 一次分配好。成功返回 0
+enum {
+  CO_BATCH_POPULATE = 1 << 0,
+};
+int co_create_batch(stCoRoutine_t** co, int n, const stCoRoutineAttr_t* attr, void* (*routine)(void*), void** args,
+                    int flags);
 
 // 唤醒协程，开始执行，协程的切换都是通过内部调用 co_swap() 函数来完成
 void co_resume(stCoRoutine_t* co);
@@ -118,21 +150,37 @@ void co_resume(stCoRoutine_t* co);
 // 2、协程内通过 co_resume 唤醒另外一个协程的时候，会直接切换到新唤醒的协程
 void co_yield(stCoRoutine_t* co);
 void co_yield_ct(); // ct = current thread
+// 对称切换：当前协程直接把执行权交给 co(例如生产者->消费者)，co 顶替当前协程在调用链上的位置，
+// 不增加调用链深度；co 结束或 yield 时回到当前协程的 resumer。当前协程挂起，需要再被 resume/transfer。
+// co 已经结束，或者在调用链上(resumer 除外，此时等价于 co_yield)时不切换，返回 -1
+int co_transfer(stCoRoutine_t* co);
 
 // 协程生命周期结束：主动调用co_release()，或者co_create()指定的入口函数执行完毕返回，协程结束。
 void co_release(stCoRoutine_t* co);
 void co_reset(stCoRoutine_t* co);
+// 已经结束(或还没开始运行)的协程换成入口函数 pfn(arg)，原地重新开始，下一次 co_resume 从 pfn 开始执行。
+// 协程私有变量、co_setenv 的环境变量、co_enable_hook_sys 都回到新建时的状态。
+// 返回 0；正在运行或挂起中(还没结束)的协程返回 -1，确定可以丢弃它的栈帧时先 co_reset
+int co_reuse(stCoRoutine_t* co, void* (*routine)(void*), void* arg);
 
 stCoRoutine_t* co_self();
 
 int co_poll(stCoEpoll_t* ctx, struct pollfd fds[], nfds_t nfds, int timeout_ms);
 void co_eventloop(stCoEpoll_t* ctx, pfn_co_eventloop_t pfn, void* arg);
+// 开启后 co_eventloop 每轮先运行已经占着自己共享栈的协程，其余的按共享栈分组运行，减少换出/换入拷贝
+void co_eventloop_set_stack_grouping(stCoEpoll_t* ctx, int enable);
 
 // 3.specific
 
 int co_setspecific(pthread_key_t key, const void* value);
 void* co_getspecific(pthread_key_t key);
 
+// 协程作用域的内存：在当前协程的区域里顺序分配(16 字节对齐)，不用也不能 free，
+// 协程函数返回、co_reset/co_reuse 或 co_release 时整体归还。区域由线程缓存的 32K 块组成，
+// 放不下的大块单独分配。用来放请求处理中的临时对象和大的临时缓冲区(不放在栈上，共享栈切换时就不用拷贝)。
+// 主协程里(以及没有协程时)返回 NULL
+void* co_arena_alloc(size_t size);
+
 // 4.event
 
 stCoEpoll_t* co_get_epoll_ct(); // ct = current thread
@@ -155,9 +203,142 @@ int co_cond_timedwait(stCoCond_t*, int timeout_ms);
 
 // 7.share stack
 stShareStack_t* co_alloc_sharestack(int iCount, int iStackSize);
+// iFlags: CO_STACK_*，CO_STACK_HUGEPAGE 分配失败时退回逐个分配
+stShareStack_t* co_alloc_sharestack_ex(int iCount, int iStackSize, int iFlags);
+// 多个栈大小档位：第 i 档 piCounts[i] 块、每块 piStackSizes[i] 字节。
+// co_create 按 attr->stack_size 选能放下的最小一档(都放不下时用最大一档)
+stShareStack_t* co_alloc_sharestack_classes(int iClassCount, const int* piCounts, const int* piStackSizes, int iFlags);
+
+// 协程分配到同一档里哪一块共享栈：
+enum {
+  CO_SHARE_ROUND_ROBIN = 0,    // 默认，按创建顺序轮流
+  CO_SHARE_LEAST_OCCUPIED = 1, // 挂在上面的协程最少的
+  CO_SHARE_LEAST_RECENT = 2,   // 最久没有协程切换上去的
+  CO_SHARE_REBALANCE = 3,      // 最近换出拷贝字节数最少的(按冲突率再平衡)
+};
+// 除 CO_SHARE_ROUND_ROBIN 外，协程每次开始运行(第一次 resume，或 co_reset 之后)时会重新挑一块栈
+void co_set_sharestack_policy(stShareStack_t* share_stack, int iPolicy);
+// 热点协程提升：共享栈协程在本线程 window_swaps 次共享栈切换之内，换出/换入拷贝累计达到 copy_bytes 时，
+// 它所在的共享栈不再分配给新协程；等这块栈上其他协程的栈帧都结束后，在它下一次挂起时把这块栈整个转给它作为独享栈
+// (栈帧里有指向栈内的绝对地址，不能搬到别的地址)，共享栈里补一块新栈。copy_bytes 为 0 时关闭(默认)
+void co_set_share_promotion(unsigned long long copy_bytes, unsigned int window_swaps);
+// CO_STACK_REMAP 共享栈上改用映射的栈深度阈值(字节)，默认 192K；example_bench remap 可以测出本机的拐点
+void co_set_share_remap_threshold(unsigned int bytes);
 
 // 8.init envlist for hook get/set env
 void co_set_env_list(const char* name[], size_t cnt);
 
+// 9.stack pool
+// 当前线程的协程栈回收池：co_release 释放的独享栈按(栈大小, 分配方式)分桶缓存，下一次 co_create 直接复用。
+// 池中缓存的字节数超过 high_watermark 时释放到 low_watermark 以下；high_watermark 为 0 表示不缓存(默认)。
+// lazy_alloc 非 0 时 co_create 不分配独享栈，推迟到第一次 co_resume/co_transfer。
+void co_set_stack_pool(size_t high_watermark, size_t low_watermark, int lazy_alloc);
+// 当前线程的协程复用链表：co_release 不释放协程，而是 co_reset 后连同独享栈一起停进链表(最多 max_parked 个)，
+// 之后栈配置相同的 co_create 直接取出来重新绑定入口函数，不用分配。max_parked 为 0 表示关闭(默认)，
+// 调小时多出来的协程立即释放
+void co_set_reuse_pool(unsigned int max_parked);
+// 当前线程之后分配的独享栈、调用 co_alloc_sharestack* 分配的共享栈都带上 CO_STACK_NUMA，
+// co_create 的协程对象也从 mbind 到本节点的内存块里分配。共享栈要在使用它的线程里分配
+void co_set_numa_local(int enable);
+
+// 10.stat
+// 当前线程的统计计数
+struct stCoStat_t {
+  unsigned long long stack_pool_hit;   // 从栈回收池取到栈
+  unsigned long long stack_pool_miss;  // 池里没有，新分配
+  unsigned long long stack_pool_put;   // 归还进池
+  unsigned long long stack_pool_free;  // 真正释放(超过水位，或没有空闲的桶)
+  unsigned long long stack_pool_bytes; // 池中当前缓存的栈字节数
+
+  unsigned long long share_copy_bytes;  // 共享栈换出+换入拷贝的字节数
+  unsigned long long save_buf_reuse;    // 换出时原地复用 save_buffer
+  unsigned long long save_buf_pool_hit; // 从 save_buffer 池取到
+  unsigned long long save_buf_alloc;    // 新 malloc 的 save_buffer
+
+  // co_eventloop_set_stack_grouping 打开时
+  unsigned long long eventloop_conflicts;       // 分组后仍需换入的共享栈协程数
+  unsigned long long eventloop_conflicts_saved; // 分组比按到达顺序少的换入次数(累计)
+  unsigned long long eventloop_last_saved;      // 上一轮少的换入次数
+
+  unsigned long long stack_trim_count; // co_trim_stack 次数(含自动回收)
+  unsigned long long stack_trim_bytes; // madvise 掉的栈字节数
+
+  unsigned long long stack_grow_count; // CO_STACK_GROWABLE 栈扩展的次数
+  unsigned long long stack_grow_bytes; // 扩展提交的字节数
+
+  unsigned long long share_pinned;   // 热点协程占住共享栈(开始等待提升)的次数
+  unsigned long long share_promoted; // 提升为独享栈的协程数
+
+  unsigned long long share_remap_count; // CO_STACK_REMAP 重新映射共享栈的次数
+
+  unsigned long long hibernate_count;        // 休眠的次数
+  unsigned long long hibernate_wake;         // 唤醒(恢复栈内容)的次数
+  unsigned long long hibernate_raw_bytes;    // 当前休眠中的栈内容字节数(压缩前)
+  unsigned long long hibernate_stored_bytes; // 当前在 slab 里实际占用的字节数
+  unsigned long long hibernate_slab_bytes;   // slab 当前分配的内存
+
+  unsigned long long reuse_hit;    // co_create 从复用链表取到协程
+  unsigned long long reuse_parked; // 复用链表里当前停着的协程数
+
+  unsigned long long arena_chunk_alloc;  // co_arena_alloc 新分配的块(含单独分配的大块)
+  unsigned long long arena_chunk_reuse;  // 从线程空闲链表取到的块
+  unsigned long long arena_cached_bytes; // 空闲链表当前缓存的字节数
+};
+void co_get_stat(stCoStat_t* stat);
+
+// 当前线程的协程内存在各 NUMA 节点上的分布(常驻页数)，节点号超过 CO_NUMA_MAX_NODES 的只计入 remote_pages
+enum {
+  CO_NUMA_MAX_NODES = 8,
+};
+struct stCoNumaStat_t {
+  int node; // 当前线程所在的节点，取不到时为 -1
+  unsigned long long stack_pages[CO_NUMA_MAX_NODES]; // 协程栈：独享栈和本线程协程用到的共享栈
+  unsigned long long co_pages[CO_NUMA_MAX_NODES];    // 协程对象 stCoRoutine_t
+  unsigned long long local_pages;  // 以上在 node 上的页
+  unsigned long long remote_pages; // 在其他节点上的页
+};
+// 返回 0；查询不了页所在节点(非 Linux 或 move_pages 失败)时返回 -1
+int co_get_numa_stat(stCoNumaStat_t* stat);
+
+// 11.idle stack trim
+// 把挂起协程栈上 sp 以下(已经不用的部分)的整页 madvise 掉，归还物理内存，协程不用销毁。
+// 返回释放的字节数；正在运行的协程、没有运行过的协程返回 -1
+long co_trim_stack(stCoRoutine_t* co);
+// 自动回收：co_eventloop 每 idle_ms 扫描一遍当前线程的协程，挂起超过 idle_ms 的协程做一次 co_trim_stack。
+// advice 为 MADV_DONTNEED(立即释放) 或 MADV_FREE(内存紧张时才回收，内核不支持时退回 MADV_DONTNEED)。
+// idle_ms 为 0 时关闭(默认)；advice 同时决定 co_trim_stack 的行为
+void co_set_idle_trim(unsigned int idle_ms, int advice);
+
+// 12.stack profile
+// 打开后当前线程新开始运行的独享栈协程会先把整个栈填充成固定的字节，协程结束、被释放/重置或采样时从栈底往上找第一个
+// 被改写过的位置，得到栈的最大使用深度，按协程函数 pfn 汇总。会把整个栈弄脏，只用于测量。
+struct stCoStackProfile_t {
+  pfn_co_routine_t pfn;
+  unsigned long long samples;
+  unsigned int stack_size;  // 最近一次测量时的栈大小
+  unsigned int max_used;    // 最大使用深度(字节)
+  unsigned int avg_used;
+  unsigned int recommended; // 建议的 stCoRoutineAttr_t::stack_size：max_used 加一半余量，按页取整
+};
+void co_set_stack_profile(int enable);
+// 对当前线程所有挂起着的、已填充的协程测量一次
+void co_stack_profile_sample();
+// 返回条数，最多填 max_count 条
+int co_get_stack_profile(stCoStackProfile_t* profiles, int max_count);
+// 以文本表格输出到 fd，能找到符号名时一并输出
+void co_dump_stack_profile(int fd);
+
+// 13.hibernate
+// 休眠：把挂起协程的栈内容([stack_sp, 栈底))搬进当前线程的紧凑 slab，独享栈的物理页 madvise 掉(地址保留，栈帧不能搬家)，
+// 共享栈协程的 save_buffer 归还；下一次 co_resume/co_yield 切回它时自动恢复。
+enum {
+  CO_HIBERNATE_COMPRESS = 1 << 0, // 用简单的 LZ 压缩栈内容，压不小时按原样存
+};
+// 返回在 slab 里占用的字节数；正在运行、在调用链上、没运行过或已结束的协程返回 -1
+long co_hibernate(stCoRoutine_t* co, int flags);
+// 自动休眠：co_eventloop 每 idle_ms 扫描一遍当前线程的协程，挂起超过 idle_ms 的协程做一次 co_hibernate。
+// idle_ms 为 0 时关闭(默认)
+void co_set_hibernate(unsigned int idle_ms, int flags);
+
 void co_log_err(const char *fmt, ...);
 #endif
@@ -40,17 +40,51 @@ struct stStackMem_t {
   int stack_size; // 栈大小
   char* stack_bp; // stack_buffer + stack_size，指向栈底(栈地址空间是由高到低)
   char* stack_buffer; // 栈空间，栈的增长方向是 stack_bp减法
+  int alloc_flags; // 实际使用的分配方式 CO_STACK_*，释放时按它来
+  char* commit_low; // CO_STACK_GROWABLE：已提交(可读写)区域的下界，[commit_low, stack_bp)
+  stStackMem_t* pNext; // 在栈回收池中时，同一个桶的下一块栈
+  int pool_key; // 申请时的分配方式(见 co_stack_pool_key)，回收池按它分桶，mmap/mbind 失败时和 alloc_flags 不同
+
+  // 以下只用于共享栈的分配策略，见 co_set_sharestack_policy()
+  int share_co_count; // 分配在这块栈上、还没释放的协程数
+  unsigned long long last_swap; // 最近一次有协程切换上来的时刻(线程内的切换序号)
+  unsigned long long save_bytes; // 换出拷贝的字节数，定期减半
+  stCoRoutine_t* sched_occupy; // co_eventloop 估算换出次数时的临时占用者
+  int share_live_count; // 已经开始运行、还没结束的协程数(栈帧在这块栈上或在 save_buffer 里)
+  stCoRoutine_t* pinned_co; // 正在等待提升为独享栈的热点协程，新协程不再分配到这块栈
+
+  // CO_STACK_REMAP：各协程后备页所在的 memfd，每个协程占 stack_size 大小的一段
+  int remap_fd;
+  stCoRoutine_t* remap_owner; // 当前映射在栈上的是哪个协程的后备页，NULL 表示匿名页
+  long remap_file_size;
+  long* remap_free; // 已释放、可以复用的偏移
+  int remap_free_count;
+  int remap_free_cap;
+
+  int numa_node; // CO_STACK_NUMA：绑定的节点，否则为 -1
+  struct stCoBatchSlab_t* batch; // co_create_batch 切出来的独享栈，释放时还给这一批
 };
 
 /**
  * 共享栈(stackless)模式
  * stackless：共享栈模式，所有协程共享 count 块提前分配好的大内存作为栈帧空间(stackarray)
  */
+struct stShareStackClass_t {
+  int stack_size;
+  int begin; // 在 stack_array 中的起始下标
+  int count;
+  unsigned int alloc_idx;
+};
+
 struct stShareStack_t {
   unsigned int alloc_idx;     // 当前索引(index)
-  int stack_size;             // 每个协程栈大小
+  int stack_size;             // 每个协程栈大小(有多档时为最大一档)
   int count;                  // stack_array条数，协程栈个数
-  stStackMem_t** stack_array; // 协程栈数组
+  stStackMem_t** stack_array; // 协程栈数组，按档位从小到大排列
+
+  int policy; // CO_SHARE_*
+  int class_count;
+  stShareStackClass_t* classes;
 };
 
 /**
@@ -59,13 +93,26 @@ struct stShareStack_t {
  * 该结构表示某个协程实例的具体内容，创建协程的时候会生成一个该结构体，所有协程的生命周期都是围绕这个结构体来的。
  */
 struct stCoRoutine_t {
+  // ---- 第一个 cache line：co_resume/co_swap 每次切换都要读写的字段 ----
   stCoRoutineEnv_t* env; // 协程环境(协程调度器？)
 
-  pfn_co_routine_t pfn; // 表示该协程对应的执行函数指针
-  void* arg; // 函数参数
+  // char sRunStack[1024 * 128];
+  // 如果是独享栈模式，分配在堆中的一块作为当前协程栈帧的内存 stack_mem，这块内存的默认大小为 128K。
+  // 独享栈在协程切换时，无需copy栈数据(因为是独享的)，只需要copy寄存器值即可，因此：独享栈性能好、但容易oom
+  stStackMem_t* stack_mem; // 独享栈
 
-  // 保存当前协程执行时的所有寄存器
-  coctx_t ctx; // 存储的是当前协程的上下文，在调用co_swap()时使用
+  // save satck buffer while confilct on same stack_buffer;
+  char* stack_sp;
+
+  // 如果是共享栈模式，协程切换的时候，用来拷贝存储当前共享栈内容的 save_buffer，长度为实际的共享栈使用长度。
+  // 共享栈模式才需要copy栈(还需寄存器)，独享栈无需copy栈，只需要把寄存器值存入ctx字段即可
+  //【这里的理解是：一个程序(或进程中的线程)启动开始执行后，必须是一个函数，然后是函数里调用其他函数，以此类推，
+  // 组成的调用链来运行程序的，也就是说真正的代码逻辑流的执行，就是函数调用链路的执行。
+  // 这里是：当前协程发生切换时，把共享栈中的属于该协程的栈帧存储在这里，因此共享栈不容易oom，但性能差(2次copy)
+  // 栈内容从 save_buffer + (stack_sp & 63) 开始存放，与共享栈上的地址在 cache line 内同相位，见 save_stack_buffer()
+  char* save_buffer; // [cIsShareStack == 1] 表示存储在共享栈模下的内容
+  unsigned int save_size;
+  unsigned int save_cap; // save_buffer 的容量，换出时长度放得下就原地复用
 
   char cStart; // 标记是否开始该协程
   char cEnd;
@@ -76,33 +123,106 @@ struct stCoRoutine_t {
 
   // libco有两种栈管理方案：stackless(共享栈模式) and stackfull(独享站模式)
   char cIsShareStack; // 是否使用协程的共享栈模式(stackless)
+  char cIdleScans; // 挂起后经过的空闲扫描次数，切换出去时清零，见 co_set_idle_trim()
+  char cHibScans; // 同 cIdleScans，自动休眠用
+  char cHibernated; // 栈内容在休眠 slab 里(hib_data)，切回来之前要先恢复，见 co_hibernate()
+  char cPromote; // 共享栈拷贝量超过阈值，下次挂起时提升为独享栈，见 co_set_share_promotion()
+  char cInBacking; // 换出后栈内容在后备页里(而不是 save_buffer)，save_size 仍是栈深度
+  char cStackPainted; // 开始运行时栈已经填充过 kCoStackPaint，见 co_set_stack_profile()
+  char cRemap; // CO_STACK_REMAP：在 stack_mem->remap_fd 里分配了后备页(remap_off)
+  char cHibCompressed;
+  char cNumaObj; // 对象本身从 NUMA 本地的对象块里分配，释放时还回去，见 co_set_numa_local()
+
+  pfn_co_routine_t pfn; // 表示该协程对应的执行函数指针
+
+  // ---- 从第二个 cache line 开始：寄存器上下文 ----
+  // 保存当前协程执行时的所有寄存器
+  coctx_t ctx; // 存储的是当前协程的上下文，在调用co_swap()时使用
+
+  // ---- 以下是创建、释放、统计和各种回收机制才用到的冷字段 ----
+  void* arg; // 函数参数
 
   void* pvEnv; // 协程环境变量：stCoSysEnvArr_t
 
-  // char sRunStack[1024 * 128];
-  // 如果是独享栈模式，分配在堆中的一块作为当前协程栈帧的内存 stack_mem，这块内存的默认大小为 128K。
-  // 独享栈在协程切换时，无需copy栈数据(因为是独享的)，只需要copy寄存器值即可，因此：独享栈性能好、但容易oom
-  stStackMem_t* stack_mem; // 独享栈
+  int stack_flags; // 创建时的 CO_STACK_*，延迟分配独享栈时使用
+  stShareStack_t* share_stack; // 共享栈模式下所属的共享栈，重新分配栈时使用
+  unsigned long long promo_window_start; // 统计窗口的起点(stCoRoutineEnv_t::share_swap_seq)
+  unsigned long long promo_bytes; // 窗口内换出/换入拷贝的字节数
+  long remap_off;
+
+  // 本线程所有协程组成的双向链表，空闲回收时扫描
+  stCoRoutine_t* pPrevCo;
+  stCoRoutine_t* pNextCo;
+
+  // 休眠时栈内容在 slab 里的位置：hib_chunk 所在块，hib_len 为存储长度，原始长度为 stack_bp - stack_sp
+  struct stCoHibChunk_t* hib_chunk;
+  char* hib_data;
+  unsigned int hib_len;
+
+  struct stCoBatchSlab_t* batch; // co_create_batch 分配的对象，释放时还给这一批
+  struct stCoArenaChunk_t* arena; // co_arena_alloc 用到的块，协程结束或重置时整体归还
+
+  // 协程私有变量(co_setspecific)：前 kInlineSpec 个不同的 key 存在对象里(key + 1，0 表示空位)，
+  // 再多时才分配一张按 key 下标的整表 pSpecTable
+  enum {
+    kInlineSpec = 4,
+    kSpecTableSize = 1024, // key 的上限(pthread_key_t 的取值范围)
+  };
+  unsigned int aSpecKey[kInlineSpec];
+  void* aSpecValue[kInlineSpec];
+  stCoSpec_t* pSpecTable;
+} __attribute__((aligned(64))); // 热字段正好占满第一个 cache line，见 co_create_env()
+
+#if defined(__x86_64__) || defined(__aarch64__)
+// 新增热字段时注意不要把 ctx 挤出第二个 cache line 的开头
+static_assert(__builtin_offsetof(stCoRoutine_t, ctx) == 64, "stCoRoutine_t hot fields must fill exactly one cache line");
+#endif
 
-  // save satck buffer while confilct on same stack_buffer;
-  char* stack_sp;
+// 当前线程正在运行的协程 | 该协程是否开启了 hook(最低位)
+// co_swap 在切换前写入，hook 住的系统调用每次都要读它，所以用 initial-exec 模型的 TLS，
+// 并通过下面的内联函数访问，省掉 GetCurrThreadCo() -> co_get_curr_thread_env() 的函数调用。
+// stCoRoutine_t 是 malloc 出来的，地址至少8字节对齐，最低位可以借用。
+// 默认的 make 构建带 -fno-inline，所以这几个函数标记为 always_inline。
+extern __thread uintptr_t gCoCurrWord __attribute__((tls_model("initial-exec")));
 
-  // 如果是共享栈模式，协程切换的时候，用来拷贝存储当前共享栈内容的 save_buffer，长度为实际的共享栈使用长度。
-  // 共享栈模式才需要copy栈(还需寄存器)，独享栈无需copy栈，只需要把寄存器值存入ctx字段即可
-  //【这里的理解是：一个程序(或进程中的线程)启动开始执行后，必须是一个函数，然后是函数里调用其他函数，以此类推，
-  // 组成的调用链来运行程序的，也就是说真正的代码逻辑流的执行，就是函数调用链路的执行。
-  // 这里是：当前协程发生切换时，把共享栈中的属于该协程的栈帧存储在这里，因此共享栈不容易oom，但性能差(2次copy)
-  char* save_buffer; // [cIsShareStack == 1] 表示存储在共享栈模下的内容
-  unsigned int save_size;
+enum {
+  kCoCurrHookBit = 1,
+};
+
+static inline __attribute__((always_inline)) stCoRoutine_t* co_self_fast() {
+  return (stCoRoutine_t*) (gCoCurrWord & ~(uintptr_t) kCoCurrHookBit);
+}
+
+static inline __attribute__((always_inline)) bool co_is_enable_sys_hook_fast() {
+  return gCoCurrWord & kCoCurrHookBit;
+}
 
-  stCoSpec_t aSpec[1024]; // 协程私有变量
+static inline __attribute__((always_inline)) void co_set_curr_word(stCoRoutine_t* co) {
+  gCoCurrWord = (uintptr_t) co | (co->cEnableSysHook ? kCoCurrHookBit : 0);
+}
+
+// 协程环境里定长对象的 slab(co_poll、co_cond_timedwait 的等待对象)：空闲对象的开头存放下一个空闲对象的指针，
+// 空了就 malloc 一块切成 obj_size 大小(按 16 字节对齐)的对象，块不归还。
+// 不加锁，只能在所属环境的线程里分配和释放
+struct stCoSlab_t {
+  void* free_list;
 };
 
+void* co_slab_alloc(stCoSlab_t* slab, size_t obj_size);
+
+static inline void co_slab_free(stCoSlab_t* slab, void* p) {
+  *(void**) p = slab->free_list;
+  slab->free_list = p;
+}
+
 // 1.env
 void co_init_curr_thread_env();
 stCoRoutineEnv_t* co_get_curr_thread_env();
 
 // 2.coroutine
+stStackMem_t* co_alloc_stackmem(unsigned int stack_size, int flags);
+void co_free_stackmem(stStackMem_t* stack_mem);
+int CoRoutineFunc(stCoRoutine_t* co, void*);
 void co_free(stCoRoutine_t* co);
 void co_yield_env(stCoRoutineEnv_t* env);
 
@@ -44,8 +44,8 @@ int main() {
 
 // 指定name类型的协程特私有变量y，有啥用？提供了一个宏让用户可以方便地使用协程私有变量。可以看到，
 // pthread_key_t 是需要用到 "线程私有变量" 的相关设施来创建的。可以看到相关实现非常简单，如果是主协程
-// 则直接使用线程私有变量的相关函数，否则使用协程结构（上面有给出协程结构的定义）的 aSpec 数组来保存，
-// aSpec 是一个大小为 1024 的数组，其数组元素类型为 stCoSpec_t。
+// 则直接使用线程私有变量的相关函数，否则保存在协程结构里：前几个 key 直接存在协程对象里(aSpecKey/aSpecValue)，
+// 用到更多 key 的协程才分配一张大小为 1024、元素类型为 stCoSpec_t 的整表。
 
 extern int co_setspecific(pthread_key_t key, const void* value);
 extern void* co_getspecific(pthread_key_t key);
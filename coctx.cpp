@@ -87,6 +87,29 @@ enum {
   kRSP = 13,
 };
 
+//-------------
+// 64 bit lean (__LIBCO_LEAN_SWAP__)，布局见 coctx.h
+enum {
+  kLeanRSP = 0,
+  kLeanRET = 1,
+  kLeanRBX = 2,
+  kLeanRBP = 3,
+  kLeanR12 = 4,
+  kLeanR13 = 5,
+  kLeanFPU = 8,
+};
+
+//-------------
+// aarch64，布局见 coctx.h
+enum {
+  kA64X19 = 0,
+  kA64X20 = 1,
+  kA64X21 = 2,
+  kA64FP = 10,
+  kA64LR = 11,
+  kA64SP = 12,
+};
+
 // 64 bit
 extern "C" {
   /**
@@ -94,6 +117,12 @@ extern "C" {
    * 第二个参数是要切换到的目的协程的上下文
    */
   extern void coctx_swap(coctx_t*, coctx_t*) asm("coctx_swap"); // libco的协程切换 coctx_swap()
+
+  /**
+   * 精简切换模式(以及aarch64)下协程的第一条指令：把保存在被调用者保存寄存器里的两个参数搬到
+   * 参数寄存器后调用 pfn，见 coctx_swap.S
+   */
+  extern void coctx_entry() asm("coctx_entry");
 };
 
 /**
@@ -115,6 +144,8 @@ int coctx_make(coctx_t* ctx, coctx_pfn_t pfn, const void* s, const void* s1) {
   coctx_param_t* param = (coctx_param_t*) sp;
   void** ret_addr = (void**) (sp - sizeof(void*) * 2);
   *ret_addr = (void*) pfn; // 栈情况：s1 -> s -> void* -> pfn(regs[7])
+  // ret 跳进 pfn 之后，esp 指向的就是 pfn 的"返回地址"：写成 0 作为哨兵，展开器(backtrace/gdb/perf)到这里结束
+  ret_addr[1] = NULL;
   param->s1 = s;  // stCoRoutine_t*
   param->s2 = s1; // 0(NULL)
 
@@ -127,14 +158,50 @@ int coctx_make(coctx_t* ctx, coctx_pfn_t pfn, const void* s, const void* s1) {
   ctx->regs[kESP] = (char*) (sp) - sizeof(void*) * 2;
   return 0;
 }
+#elif defined(__x86_64__) && defined(__LIBCO_LEAN_SWAP__)
+/**
+ * 精简切换模式：栈顶下面是一个返回地址槽，和 co_swap 调用 coctx_swap 时的栈形状一样。
+ * 首次切换时 coctx_swap 把 coctx_entry 写进这个槽再 ret，之后 rsp 是16字节对齐的，
+ * coctx_entry 再通过 call 调用 pfn(s, s1)，这样 pfn 看到的栈和普通函数调用完全一致。
+ */
+int coctx_make(coctx_t* ctx, coctx_pfn_t pfn, const void* s, const void* s1) {
+  char* sp = ctx->ss_sp + ctx->ss_size;
+  sp = (char*) ((unsigned long) sp & -16LL);
+  void** ret_addr = (void**) (sp - sizeof(void*));
+  *ret_addr = (void*) coctx_entry;
+
+  memset(ctx->regs, 0, sizeof(ctx->regs));
+  ctx->regs[kLeanRSP] = ret_addr;
+  ctx->regs[kLeanRET] = (char*) coctx_entry;
+  ctx->regs[kLeanRBX] = (char*) pfn;
+  ctx->regs[kLeanR12] = (char*) s;
+  ctx->regs[kLeanR13] = (char*) s1;
+
+#if defined(__LIBCO_SAVE_FPU__)
+  // 新协程继承创建者当前的浮点控制状态(舍入模式、异常屏蔽位)
+  unsigned int* fpu = (unsigned int*) &ctx->regs[kLeanFPU];
+  __asm__ __volatile__("stmxcsr %0" : "=m"(fpu[0]));
+  __asm__ __volatile__("fnstcw %0" : "=m"(*(unsigned short*) &fpu[1]));
+#endif
+  return 0;
+}
+
+int coctx_init(coctx_t* ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+  return 0;
+}
+
 #elif defined(__x86_64__)
 int coctx_make(coctx_t* ctx, coctx_pfn_t pfn, const void* s, const void* s1) {
-  char* sp = ctx->ss_sp + ctx->ss_size - sizeof(void*);
+  char* sp = ctx->ss_sp + ctx->ss_size - sizeof(void*) * 2; // pfn + 哨兵返回地址
   sp = (char*) ((unsigned long) sp & -16LL);
 
   memset(ctx->regs, 0, sizeof(ctx->regs));
   void** ret_addr = (void**) (sp);
   *ret_addr = (void*) pfn;
+  // ret 跳进 pfn 之后，rsp 指向的就是 pfn 的"返回地址"：写成 0 作为哨兵，展开器(backtrace/gdb/perf)到这里结束；
+  // rbp 为 0(regs 已清零)，帧指针链也到 pfn 结束
+  ret_addr[1] = NULL;
 
   ctx->regs[kRSP] = sp; // 栈顶寄存器，存储在第13索引处(寄存器数组中的最后一个位置)
   ctx->regs[kRETAddr] = (char*) pfn; // 函数返回地址存储在第9索引处
@@ -148,4 +215,28 @@ int coctx_init(coctx_t* ctx) {
   return 0;
 }
 
+#elif defined(__aarch64__)
+/**
+ * aarch64：首次切换时 coctx_swap 最后的 ret 跳到 lr(coctx_entry)，
+ * coctx_entry 把 x20/x21 搬到 x0/x1 后 blr x19(pfn)
+ */
+int coctx_make(coctx_t* ctx, coctx_pfn_t pfn, const void* s, const void* s1) {
+  char* sp = ctx->ss_sp + ctx->ss_size;
+  sp = (char*) ((unsigned long) sp & -16L); // AAPCS64 要求 sp 16字节对齐
+
+  memset(ctx->regs, 0, sizeof(ctx->regs));
+  ctx->regs[kA64X19] = (char*) pfn;
+  ctx->regs[kA64X20] = (char*) s;
+  ctx->regs[kA64X21] = (char*) s1;
+  ctx->regs[kA64FP] = NULL;
+  ctx->regs[kA64LR] = (char*) coctx_entry;
+  ctx->regs[kA64SP] = sp;
+  return 0;
+}
+
+int coctx_init(coctx_t* ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+  return 0;
+}
+
 #endif
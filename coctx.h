@@ -84,6 +84,31 @@ struct coctx_t { // libco中，协程上下文保存在此结构体中
   //      | regs[6]: ebp |
   // high | regs[7]: eax |  = esp，初始化时，存储的是协程函数的地址pfn，以此还有其两个参数
   void* regs[8]; // 8个寄存器，用于保存或设定特定寄存器值
+#elif defined(__x86_64__) && defined(__LIBCO_LEAN_SWAP__)
+  // 精简版64bit协程上下文(编译时定义 __LIBCO_LEAN_SWAP__ 开启)：
+  // 协程切换一定发生在 coctx_swap() 这个函数调用处，按 SysV ABI 调用者保存寄存器(rax/rcx/rdx/rsi/rdi/r8~r11)
+  // 在call之前已经由编译器处理，因此只需要保存被调用者保存寄存器：rsp/rbx/rbp/r12~r15，外加返回地址。
+  // low  | regs[0]: rsp | 指向返回地址槽
+  //      | regs[1]: ret | 返回地址，恢复时写回 rsp 指向的槽再 ret
+  //      | regs[2]: rbx | 首次运行时：协程入口函数 pfn
+  //      | regs[3]: rbp |
+  //      | regs[4]: r12 | 首次运行时：pfn 的第1个参数
+  //      | regs[5]: r13 | 首次运行时：pfn 的第2个参数
+  //      | regs[6]: r14 |
+  //      | regs[7]: r15 |
+  // high | regs[8]: mxcsr(低32位) + x87控制字(高位)，仅 __LIBCO_SAVE_FPU__ 时保存/恢复
+  void* regs[9];
+#elif defined(__aarch64__)
+  // AArch64(AAPCS64)协程上下文：只需保存被调用者保存寄存器 x19~x28、fp(x29)、lr(x30)、sp、d8~d15
+  // low  | regs[0]:  x19 | 首次运行时：协程入口函数 pfn
+  //      | regs[1]:  x20 | 首次运行时：pfn 的第1个参数
+  //      | regs[2]:  x21 | 首次运行时：pfn 的第2个参数
+  //      | regs[3~9]: x22~x28 |
+  //      | regs[10]: x29 | fp
+  //      | regs[11]: x30 | lr，返回地址，coctx_swap 最后 ret 到这里
+  //      | regs[12]: sp  |
+  // high | regs[13~20]: d8~d15 |
+  void* regs[21];
 #else
   void* regs[14]; // 最多存储14个寄存器，每个寄存器是8字节，所以寄存器组最后一个偏移量是112=13*8
 #endif
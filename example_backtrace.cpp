@@ -0,0 +1,106 @@
+/*
+* Tencent is pleased to support the open source community by making Libco
+available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stdio.h>
+#include <string.h>
+
+// 在协程里调用 backtrace()，检查调用栈能展开到 CoRoutineFunc，并且在那里结束，
+// 不会越过协程栈跑到 resumer 的栈上或者读到垃圾返回地址。
+// 需要 -rdynamic 链接(dladdr 才能找到可执行文件里的符号)，返回值 0 表示通过。
+
+struct stBacktraceArg_t {
+  const char* name;
+  stCoRoutine_t* nested; // 非空时在协程里再 resume 一个协程，检查嵌套时的展开
+  int ok;
+};
+
+static int CheckBacktrace(const char* name) __attribute__((noinline));
+static int CheckBacktrace(const char* name) {
+  void* frames[64];
+  int n = backtrace(frames, 64);
+
+  int entry = -1;
+  for (int i = 0; i < n; i++) {
+    Dl_info info;
+    memset(&info, 0, sizeof(info));
+    if (dladdr(frames[i], &info) && info.dli_saddr == (void*) CoRoutineFunc) {
+      entry = i;
+      break;
+    }
+  }
+
+  // CoRoutineFunc 外面最多还有一层 coctx_entry(精简切换模式/aarch64)
+  int ok = entry >= 0 && n - entry <= 2;
+  printf("%s: %d frames, CoRoutineFunc at #%d -> %s\n", name, n, entry, ok ? "ok" : "FAIL");
+  if (!ok) {
+    backtrace_symbols_fd(frames, n, 1);
+  }
+  return ok;
+}
+
+static void* BacktraceRoutine(void* arg) {
+  stBacktraceArg_t* bt = (stBacktraceArg_t*) arg;
+  if (bt->nested) {
+    co_resume(bt->nested);
+  }
+  bt->ok = CheckBacktrace(bt->name);
+  return NULL;
+}
+
+int main() {
+  Dl_info info;
+  if (!dladdr((void*) CoRoutineFunc, &info) || !info.dli_sname) {
+    printf("CoRoutineFunc not in dynamic symbol table, link with -rdynamic\n");
+    return 0;
+  }
+
+  int ok = 1;
+
+  // 1. 独享栈
+  stBacktraceArg_t priv = {"private stack", NULL, 0};
+  stCoRoutine_t* co = NULL;
+  co_create(&co, NULL, BacktraceRoutine, &priv);
+  co_resume(co);
+  ok &= priv.ok;
+
+  // 2. 共享栈
+  stShareStack_t* share_stack = co_alloc_sharestack(1, 128 * 1024);
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share_stack;
+  stBacktraceArg_t shared = {"shared stack", NULL, 0};
+  co_create(&co, &attr, BacktraceRoutine, &shared);
+  co_resume(co);
+  ok &= shared.ok;
+
+  // 3. 协程里再 resume 协程：内层的展开也要停在它自己的 CoRoutineFunc
+  stBacktraceArg_t inner = {"nested inner", NULL, 0};
+  stBacktraceArg_t outer = {"nested outer", NULL, 0};
+  co_create(&outer.nested, NULL, BacktraceRoutine, &inner);
+  co_create(&co, NULL, BacktraceRoutine, &outer);
+  co_resume(co);
+  ok &= inner.ok && outer.ok;
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,1170 @@
+/*
+* Tencent is pleased to support the open source community by making Libco
+available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <alloca.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#endif
+
+// 性能基准：
+//   example_bench switch [LOOPS]   co_resume+co_yield 往返耗时(ns/round trip)
+//   example_bench transfer [LOOPS] 两个协程交替执行的交接耗时：经 resumer 中转 vs co_transfer 直接切换
+//   example_bench sharestack [LOOPS] 两个协程共用一块共享栈交替执行(每次切换都要拷贝栈)的耗时
+//   example_bench rss [N] [mmap]   创建 N 个(默认10000)协程各运行一次，统计每个协程的常驻内存(KB)
+//   example_bench churn [N] [pool] [reuse|inplace] [mmap] co_create/co_resume/co_release 循环的耗时，pool 打开栈回收池，
+//                                  reuse 打开协程复用链表(co_set_reuse_pool)，inplace 改为同一个协程反复 co_reuse
+//   example_bench tlb [STACKS] [hugepage] STACKS(默认64)块128K共享栈、2倍的协程轮流切换，
+//                                  每次切换都要换出/换入栈内容，统计 ns/switch 和 dTLB miss/switch
+//   example_bench assign [rr|occupied|recent|rebalance] [promote] 8块共享栈上常驻热点协程 + 短命请求协程，
+//                                  比较共享栈分配策略下每轮的栈拷贝字节数；promote 打开热点协程提升(co_set_share_promotion)
+//   example_bench eventloop [group] 8块共享栈上32个协程由 co_eventloop 调度，group 打开按共享栈分组，比较每轮的栈拷贝字节数
+//   example_bench idle [N] [free]  N(默认1000)个弄脏了栈的协程挂起后，打开空闲回收(co_set_idle_trim)前后的常驻内存
+//   example_bench stackprof        打开栈剖析(co_set_stack_profile)，输出每种协程函数的栈使用深度和建议的栈大小
+//   example_bench grow [N] [overflow] N(默认1000)个上限8M的可增长栈协程挂起时的常驻内存，再跑一个约6M深的递归；
+//                                  overflow 最后故意超过上限，应输出溢出信息后崩溃
+//   example_bench remap [DEPTH_KB] 两个协程共用一块 CO_STACK_REMAP 共享栈，栈深 DEPTH_KB(默认从4K到512K逐档)，
+//                                  比较 memcpy 和重新映射两种切换方式的耗时，找出 co_set_share_remap_threshold 的拐点
+//   example_bench hibernate [N] [lz] [share] N(默认10000)个挂起的长连接协程，co_eventloop 自动休眠(co_set_hibernate)前后
+//                                  每个协程的常驻内存和 slab 占用，lz 打开压缩，share 改用共享栈
+//   example_bench numa [N]         工作线程里 N(默认1000)个协程(一半用共享栈)的栈页和协程对象页所在的 NUMA 节点：
+//                                  共享栈由主线程分配并弄脏 vs co_set_numa_local 打开
+//   example_bench startup [N] [batch] [populate] 启动时创建 N(默认50000)个协程并各 resume 一次的就绪耗时：
+//                                  逐个 co_create vs co_create_batch(populate 预先分配协程对象的内存)
+//   example_bench arena [N] [stack|malloc] N(默认200000)个共享栈上的请求协程，16K 临时缓冲区和 16 个小对象
+//                                  用 co_arena_alloc 分配(默认) vs 放在栈上 / malloc，比较耗时和共享栈拷贝量
+//   example_bench allocs [N]       co_poll(1 个 fd / 共享栈上 2 个 fd)、co_cond_timedwait、hook 的 socket+close
+//                                  每次操作的耗时；malloc 次数要用 example_bench_allocs allocs 统计
+//                                  (同一份代码，链接时 -Wl,--wrap=malloc 等把分配函数换成计数的版本)
+// co_swap 的栈策略：make PRIVATE_STACK_ONLY=1 / SHARE_STACK_ONLY=1，对比 switch/sharestack 的结果
+// 对比不同的切换实现时，用不同的编译选项各编译一次，例如：
+//   make && ./example_bench switch
+//   make clean && make LEAN_SWAP=1 && ./example_bench switch
+
+extern "C" {
+  extern void coctx_swap(coctx_t*, coctx_t*) asm("coctx_swap");
+};
+
+static unsigned long long NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char* SwapName() {
+#if defined(__aarch64__)
+  return "aarch64";
+#elif defined(__x86_64__) && defined(__LIBCO_LEAN_SWAP__) && defined(__LIBCO_SAVE_FPU__)
+  return "x86_64 lean+fpu";
+#elif defined(__x86_64__) && defined(__LIBCO_LEAN_SWAP__)
+  return "x86_64 lean";
+#elif defined(__x86_64__)
+  return "x86_64 full";
+#else
+  return "i386";
+#endif
+}
+
+static const char* PolicyName() {
+#if defined(__LIBCO_PRIVATE_STACK_ONLY__)
+  return "private-only";
+#elif defined(__LIBCO_SHARE_STACK_ONLY__)
+  return "share-only";
+#else
+  return "mixed";
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// switch：co_resume/co_yield 往返。只测裸 coctx_swap 会掩盖返回地址预测错误，
+// 那部分代价落在 co_swap/co_resume/co_yield_env 之后的 ret 上，所以按用户实际调用的路径计时
+
+static void* PeerRoutine(void*) {
+  for (;;) {
+    co_yield_ct();
+  }
+  return NULL;
+}
+
+static void BenchSwitch(long loops) {
+  stCoRoutine_t* co = NULL;
+  co_create(&co, NULL, PeerRoutine, NULL);
+  co_resume(co); // warm up
+  unsigned long long begin = NowNs();
+  for (long i = 0; i < loops; i++) {
+    co_resume(co);
+  }
+  unsigned long long cost = NowNs() - begin;
+  printf("co_resume+co_yield [%s, %s]: %.2f ns/round trip\n", SwapName(), PolicyName(), (double) cost / loops);
+}
+
+// ---------------------------------------------------------------------------
+// transfer：生产者/消费者交替执行，每次交接(hand-off)的耗时
+
+static stCoRoutine_t* g_stage[2];
+static long g_handoff_left;
+
+static void* YieldStage(void*) {
+  for (;;) {
+    co_yield_ct();
+  }
+  return NULL;
+}
+
+static void* TransferStage(void* arg) {
+  long idx = (long) arg;
+  if (idx == 0) {
+    while (g_handoff_left > 0) {
+      g_handoff_left -= 2;
+      co_transfer(g_stage[1]);
+    }
+    return NULL; // 结束后回到 resumer(main)
+  }
+  for (;;) {
+    co_transfer(g_stage[0]);
+  }
+  return NULL;
+}
+
+static void BenchTransfer(long loops) {
+  // 1. 经 resumer 中转：A yield -> main -> resume B，每次交接2次切换
+  stCoRoutine_t* a = NULL;
+  stCoRoutine_t* b = NULL;
+  co_create(&a, NULL, YieldStage, NULL);
+  co_create(&b, NULL, YieldStage, NULL);
+  co_resume(a);
+  co_resume(b);
+  unsigned long long begin = NowNs();
+  for (long i = 0; i < loops; i += 2) {
+    co_resume(a);
+    co_resume(b);
+  }
+  unsigned long long cost = NowNs() - begin;
+  printf("resume/yield via resumer: %.2f ns/hand-off\n", (double) cost / loops);
+
+  // 2. co_transfer：A 直接切到 B，每次交接1次切换
+  co_create(&g_stage[0], NULL, TransferStage, (void*) 0);
+  co_create(&g_stage[1], NULL, TransferStage, (void*) 1);
+  g_handoff_left = loops;
+  begin = NowNs();
+  co_resume(g_stage[0]);
+  cost = NowNs() - begin;
+  printf("co_transfer: %.2f ns/hand-off\n", (double) cost / loops);
+}
+
+// ---------------------------------------------------------------------------
+// sharestack：两个协程共用一块共享栈，交替 resume
+
+static void* ShareStackRoutine(void*) {
+  char buf[1024]; // 让每次换出都有一段栈内容要保存
+  memset(buf, 0, sizeof(buf));
+  for (;;) {
+    buf[0]++;
+    __asm__ __volatile__("" : : "r"(buf) : "memory"); // 不让编译器把 buf 优化掉
+    co_yield_ct();
+  }
+  return NULL;
+}
+
+static void BenchShareStack(long loops) {
+  stShareStack_t* share_stack = co_alloc_sharestack(1, 128 * 1024);
+  stCoRoutineAttr_t attr;
+  attr.stack_size = 0;
+  attr.share_stack = share_stack;
+
+  stCoRoutine_t* a = NULL;
+  stCoRoutine_t* b = NULL;
+  co_create(&a, &attr, ShareStackRoutine, NULL);
+  co_create(&b, &attr, ShareStackRoutine, NULL);
+  co_resume(a);
+  co_resume(b);
+  stCoStat_t before;
+  co_get_stat(&before);
+  unsigned long long begin = NowNs();
+  for (long i = 0; i < loops; i += 2) {
+    co_resume(a);
+    co_resume(b);
+  }
+  unsigned long long cost = NowNs() - begin;
+  stCoStat_t after;
+  co_get_stat(&after);
+  printf("shared stack co_resume/co_yield [%s, %s]: %.2f ns/switch\n", SwapName(), PolicyName(),
+         (double) cost / (loops * 2));
+  printf("  copied %.0f bytes/switch, save_buffer reuse=%llu pool_hit=%llu alloc=%llu\n",
+         (double) (after.share_copy_bytes - before.share_copy_bytes) / (loops * 2),
+         after.save_buf_reuse - before.save_buf_reuse, after.save_buf_pool_hit - before.save_buf_pool_hit,
+         after.save_buf_alloc - before.save_buf_alloc);
+}
+
+// ---------------------------------------------------------------------------
+// rss：每个协程实际占用的常驻内存
+
+static long RssKB() {
+  long pages = 0;
+  long rss = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (!fp) {
+    return 0;
+  }
+  if (fscanf(fp, "%ld %ld", &pages, &rss) != 2) {
+    rss = 0;
+  }
+  fclose(fp);
+  return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void* ShallowRoutine(void*) {
+  char buf[512]; // 只用到栈顶的一页
+  memset(buf, 0, sizeof(buf));
+  co_yield_ct();
+  return NULL;
+}
+
+static void BenchRss(long n, int stack_flags) {
+  stCoRoutineAttr_t attr;
+  attr.stack_flags = stack_flags;
+  stCoRoutine_t** cos = (stCoRoutine_t**) calloc(n, sizeof(stCoRoutine_t*));
+
+  long before = RssKB();
+  unsigned long long begin = NowNs();
+  for (long i = 0; i < n; i++) {
+    co_create(&cos[i], &attr, ShallowRoutine, NULL);
+    co_resume(cos[i]);
+  }
+  unsigned long long cost = NowNs() - begin;
+  long after = RssKB();
+  printf("%ld coroutines [stack_size %d, %s]: %.2f KB rss/co, %.2f us create+resume/co\n", n,
+         attr.stack_size, stack_flags & CO_STACK_MMAP ? "mmap" : "malloc",
+         (double) (after - before) / n, (double) cost / n / 1000);
+
+  for (long i = 0; i < n; i++) {
+    co_release(cos[i]);
+  }
+  free(cos);
+}
+
+// ---------------------------------------------------------------------------
+// churn：每个请求一个协程，创建 -> 运行结束 -> 释放
+
+static void* EmptyRoutine(void*) {
+  return NULL;
+}
+
+static void BenchChurn(long n, int pool, int reuse, int stack_flags) {
+  if (pool) {
+    co_set_stack_pool(8 * 1024 * 1024, 4 * 1024 * 1024, 0);
+  }
+  if (reuse == 1) {
+    co_set_reuse_pool(64);
+  }
+  stCoRoutineAttr_t attr;
+  attr.stack_flags = stack_flags;
+
+  unsigned long long begin = NowNs();
+  if (reuse == 2) { // 同一个协程对象反复 co_reuse
+    stCoRoutine_t* co = NULL;
+    co_create(&co, &attr, EmptyRoutine, NULL);
+    for (long i = 0; i < n; i++) {
+      co_reuse(co, EmptyRoutine, NULL);
+      co_resume(co);
+    }
+    co_release(co);
+  } else {
+    for (long i = 0; i < n; i++) {
+      stCoRoutine_t* co = NULL;
+      co_create(&co, &attr, EmptyRoutine, NULL);
+      co_resume(co);
+      co_release(co);
+    }
+  }
+  unsigned long long cost = NowNs() - begin;
+
+  stCoStat_t stat;
+  co_get_stat(&stat);
+  unsigned long long total = stat.stack_pool_hit + stat.stack_pool_miss;
+  const char* reuse_names[] = {"no reuse", "reuse pool", "co_reuse"};
+  printf("churn [%s, %s, %s]: %.2f ns/co, stack pool hit %.2f%%, %llu bytes cached, reuse hit %llu\n",
+         pool ? "pool" : "no pool", reuse_names[reuse], stack_flags & CO_STACK_MMAP ? "mmap" : "malloc",
+         (double) cost / n, total ? 100.0 * stat.stack_pool_hit / total : 0.0, stat.stack_pool_bytes,
+         stat.reuse_hit);
+}
+
+// ---------------------------------------------------------------------------
+// tlb：大量共享栈上的切换，比较普通分配与大页 arena 的 dTLB miss
+
+static int OpenDtlbMissCounter() {
+#if defined(__linux__)
+  struct perf_event_attr pe;
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HW_CACHE;
+  pe.size = sizeof(pe);
+  pe.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  pe.disabled = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static void* TlbRoutine(void*) {
+  char buf[2048]; // 每次换出/换入约2KB栈内容
+  memset(buf, 0, sizeof(buf));
+  for (;;) {
+    buf[0]++;
+    __asm__ __volatile__("" : : "r"(buf) : "memory"); // 不让编译器把 buf 优化掉
+    co_yield_ct();
+  }
+  return NULL;
+}
+
+static void BenchTlb(int stacks, long loops, int flags) {
+  stShareStack_t* share_stack = co_alloc_sharestack_ex(stacks, 128 * 1024, flags);
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share_stack;
+
+  int n = stacks * 2; // 每块共享栈上两个协程，轮流切换时总是冲突
+  stCoRoutine_t** cos = (stCoRoutine_t**) calloc(n, sizeof(stCoRoutine_t*));
+  for (int i = 0; i < n; i++) {
+    co_create(&cos[i], &attr, TlbRoutine, NULL);
+    co_resume(cos[i]);
+  }
+
+  int fd = OpenDtlbMissCounter();
+  long long misses = 0;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  unsigned long long begin = NowNs();
+  for (long i = 0; i < loops; i++) {
+    co_resume(cos[i % n]);
+  }
+  unsigned long long cost = NowNs() - begin;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+      misses = 0;
+    }
+    close(fd);
+  }
+
+  const char* kind = share_stack->stack_array[0]->alloc_flags & CO_STACK_HUGEPAGE ? "hugepage arena" : "per-stack";
+  if (fd >= 0) {
+    printf("%d shared stacks [%s]: %.2f ns/switch, %.3f dTLB-load-misses/switch\n", stacks, kind,
+           (double) cost / (loops * 2), (double) misses / (loops * 2));
+  } else {
+    printf("%d shared stacks [%s]: %.2f ns/switch, dTLB counter unavailable (perf_event_open: %s)\n",
+           stacks, kind, (double) cost / (loops * 2), strerror(errno));
+  }
+}
+
+// ---------------------------------------------------------------------------
+// assign：共享栈分配策略。两个常驻的热点协程每轮都运行，同时不断有短命的请求协程创建、运行几轮后释放，
+// 统计每轮换出/换入拷贝的字节数
+
+static const int kAssignRounds = 4; // 请求协程运行几轮后结束
+
+static void* AssignRoutine(void* arg) {
+  char buf[2048];
+  memset(buf, 0, sizeof(buf));
+  long rounds = (long) arg; // 0 表示常驻
+  for (long i = 0; !rounds || i < rounds; i++) {
+    buf[0]++;
+    __asm__ __volatile__("" : : "r"(buf) : "memory");
+    co_yield_ct();
+  }
+  return NULL;
+}
+
+static void BenchAssign(long loops, int policy, int promote) {
+  const char* names[] = {"round-robin", "least-occupied", "least-recent", "rebalance"};
+  if (promote) {
+    co_set_share_promotion(64 * 1024, 4096);
+  }
+  stShareStack_t* share_stack = co_alloc_sharestack(8, 128 * 1024);
+  co_set_sharestack_policy(share_stack, policy);
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share_stack;
+
+  stCoRoutine_t* hot[2];
+  for (int i = 0; i < 2; i++) {
+    co_create(&hot[i], &attr, AssignRoutine, NULL);
+  }
+  stCoRoutine_t* reqs[kAssignRounds] = {NULL};
+
+  stCoStat_t before;
+  co_get_stat(&before);
+  unsigned long long begin = NowNs();
+  for (long n = 0; n < loops; n++) {
+    co_resume(hot[0]);
+    co_resume(hot[1]);
+    stCoRoutine_t*& req = reqs[n % kAssignRounds];
+    if (req) {
+      co_resume(req); // 第 kAssignRounds 次 resume 时运行结束
+      co_release(req);
+    }
+    co_create(&req, &attr, AssignRoutine, (void*) (long) kAssignRounds);
+    for (int i = 0; i < kAssignRounds; i++) {
+      if (reqs[i] && reqs[i] != req) {
+        co_resume(reqs[i]);
+      }
+    }
+    co_resume(req);
+  }
+  unsigned long long cost = NowNs() - begin;
+  stCoStat_t after;
+  co_get_stat(&after);
+  printf("shared stack assignment [%s%s]: %.2f ns/round, copied %.0f bytes/round, promoted %llu\n", names[policy],
+         promote ? " + promotion" : "", (double) cost / loops,
+         (double) (after.share_copy_bytes - before.share_copy_bytes) / loops, after.share_promoted);
+}
+
+// ---------------------------------------------------------------------------
+// eventloop：8块共享栈上的32个协程等同一个条件变量，co_eventloop 每轮 broadcast 一次
+
+static const int kLoopStacks = 8;
+static const int kLoopCos = 32;
+static const int kLoopIterations = 1000;
+
+struct stLoopBench_t {
+  stCoCond_t* cond;
+  int iterations;
+};
+
+static void* LoopRoutine(void* arg) {
+  stLoopBench_t* bench = (stLoopBench_t*) arg;
+  char buf[2048];
+  memset(buf, 0, sizeof(buf));
+  for (;;) {
+    co_cond_timedwait(bench->cond, -1);
+    buf[0]++;
+    __asm__ __volatile__("" : : "r"(buf) : "memory");
+  }
+  return NULL;
+}
+
+static int LoopTick(void* arg) {
+  stLoopBench_t* bench = (stLoopBench_t*) arg;
+  if (++bench->iterations > kLoopIterations) {
+    return -1;
+  }
+  co_cond_broadcast(bench->cond);
+  return 0;
+}
+
+static void BenchEventLoop(int group) {
+  stShareStack_t* share_stack = co_alloc_sharestack(kLoopStacks, 128 * 1024);
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share_stack;
+  stLoopBench_t bench = {co_cond_alloc(), 0};
+  for (int i = 0; i < kLoopCos; i++) {
+    stCoRoutine_t* co = NULL;
+    co_create(&co, &attr, LoopRoutine, &bench);
+    co_resume(co);
+  }
+
+  co_eventloop_set_stack_grouping(co_get_epoll_ct(), group);
+  stCoStat_t before;
+  co_get_stat(&before);
+  co_eventloop(co_get_epoll_ct(), LoopTick, &bench);
+  stCoStat_t after;
+  co_get_stat(&after);
+  printf("eventloop %d coroutines on %d shared stacks [%s]: copied %.0f bytes/iteration", kLoopCos, kLoopStacks,
+         group ? "grouped" : "arrival order",
+         (double) (after.share_copy_bytes - before.share_copy_bytes) / kLoopIterations);
+  if (group) {
+    printf(", %.1f swap-ins saved/iteration", (double) (after.eventloop_conflicts_saved - before.eventloop_conflicts_saved) / kLoopIterations);
+  }
+  printf("\n");
+}
+
+// ---------------------------------------------------------------------------
+// idle：N 个协程像 echosvr 的 worker 一样先用过 16K 的缓冲区，再挂起等待；打开空闲回收后跑一会 co_eventloop
+
+static void DeepCall(int depth) {
+  char buf[16 * 1024];
+  memset(buf, depth, sizeof(buf));
+  __asm__ __volatile__("" : : "r"(buf) : "memory");
+  if (depth > 0) {
+    DeepCall(depth - 1);
+  }
+}
+
+static void* IdleRoutine(void*) {
+  DeepCall(3); // 弄脏栈上约64K
+  co_yield_ct(); // 之后一直挂起
+  return NULL;
+}
+
+static int IdleTick(void* arg) {
+  return NowNs() > *(unsigned long long*) arg ? -1 : 0;
+}
+
+static void BenchIdle(int n, int advice) {
+  long rss_begin = RssKB();
+  for (int i = 0; i < n; i++) {
+    stCoRoutine_t* co = NULL;
+    co_create(&co, NULL, IdleRoutine, NULL);
+    co_resume(co);
+  }
+  long rss_parked = RssKB();
+
+  co_set_idle_trim(10, advice);
+  unsigned long long deadline = NowNs() + 50 * 1000 * 1000ULL;
+  co_eventloop(co_get_epoll_ct(), IdleTick, &deadline);
+  long rss_trimmed = RssKB();
+
+  stCoStat_t stat;
+  co_get_stat(&stat);
+  printf("%d parked coroutines [%s]: %.1f KB/coroutine before trim, %.1f KB after, trimmed %llu stacks %llu KB\n",
+         n, advice == MADV_FREE ? "MADV_FREE" : "MADV_DONTNEED", (double) (rss_parked - rss_begin) / n,
+         (double) (rss_trimmed - rss_begin) / n, stat.stack_trim_count, stat.stack_trim_bytes / 1024);
+}
+
+// ---------------------------------------------------------------------------
+// stackprof：几种栈深度不同的协程跑完后输出按协程函数汇总的栈使用深度
+
+static void* ShallowWorker(void*) {
+  DeepCall(0);
+  return NULL;
+}
+
+static void* DeepWorker(void* arg) {
+  DeepCall((int) (long) arg);
+  co_yield_ct(); // 有一半在挂起时采样
+  return NULL;
+}
+
+static void BenchStackProfile() {
+  co_set_stack_profile(1);
+  stCoRoutine_t* parked[100];
+  for (int i = 0; i < 100; i++) {
+    stCoRoutine_t* co = NULL;
+    co_create(&co, NULL, ShallowWorker, NULL);
+    co_resume(co);
+    co_release(co);
+
+    co_create(&parked[i], NULL, DeepWorker, (void*) (long) (i % 4));
+    co_resume(parked[i]);
+  }
+  co_stack_profile_sample();
+  for (int i = 0; i < 100; i++) {
+    co_resume(parked[i]);
+    co_release(parked[i]);
+  }
+  co_dump_stack_profile(1);
+}
+
+// ---------------------------------------------------------------------------
+// grow：上限 8M 的可增长栈，挂起时的常驻内存，以及深递归时的扩展
+
+static void* GrowRoutine(void* arg) {
+  int depth = (int) (long) arg;
+  if (depth < 0) { // 超过上限：输出溢出信息后崩溃
+    for (;;) {
+      DeepCall(1 << 20);
+    }
+  }
+  if (depth > 0) {
+    DeepCall(depth);
+  }
+  co_yield_ct();
+  return NULL;
+}
+
+static void BenchGrow(int n, int overflow) {
+  stCoRoutineAttr_t attr;
+  attr.stack_size = 8 * 1024 * 1024;
+  attr.stack_flags = CO_STACK_GROWABLE;
+
+  long rss_begin = RssKB();
+  for (int i = 0; i < n; i++) {
+    stCoRoutine_t* co = NULL;
+    co_create(&co, &attr, GrowRoutine, (void*) 0L);
+    co_resume(co);
+  }
+  printf("%d parked coroutines on 8M growable stacks: %.1f KB/coroutine\n", n,
+         (double) (RssKB() - rss_begin) / n);
+
+  stCoStat_t before;
+  co_get_stat(&before);
+  stCoRoutine_t* deep = NULL;
+  co_create(&deep, &attr, GrowRoutine, (void*) 400L); // 约 6.4M
+  co_resume(deep);
+  stCoStat_t after;
+  co_get_stat(&after);
+  printf("deep recursion: grew %llu times, %llu KB committed\n", after.stack_grow_count - before.stack_grow_count,
+         (after.stack_grow_bytes - before.stack_grow_bytes) / 1024);
+
+  if (overflow) {
+    co_create(&deep, &attr, GrowRoutine, (void*) -1L);
+    co_resume(deep);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// remap：两个协程共用一块 CO_STACK_REMAP 共享栈，栈很深但每次只用到栈顶，
+// 比较 memcpy 换出/换入和重新映射后备页的切换耗时
+
+static int g_remap_stop;
+
+static void* RemapRoutine(void* arg) {
+  long depth = (long) arg;
+  char id = (char) (long) co_self();
+  char* frame = (char*) alloca(depth); // 深栈帧，只在开始时整个写一遍
+  memset(frame, id, depth);
+  while (!g_remap_stop) {
+    co_yield_ct();
+    if (frame[0] != id || frame[depth - 1] != id) { // 换入后栈内容要原样恢复
+      printf("remap: stack corrupted\n");
+      abort();
+    }
+    frame[0] = id;
+  }
+  return NULL;
+}
+
+static void BenchRemapOne(long depth, long loops, int remap) {
+  co_set_share_remap_threshold(remap ? 0 : ~0u);
+  stShareStack_t* share_stack = co_alloc_sharestack_ex(1, 1024 * 1024, CO_STACK_REMAP);
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share_stack;
+  stCoRoutine_t* co[2];
+  for (int i = 0; i < 2; i++) {
+    co_create(&co[i], &attr, RemapRoutine, (void*) depth);
+  }
+
+  g_remap_stop = 0;
+  stCoStat_t before;
+  co_get_stat(&before);
+  unsigned long long begin = NowNs();
+  for (long n = 0; n < loops; n++) {
+    co_resume(co[0]);
+    co_resume(co[1]);
+  }
+  unsigned long long cost = NowNs() - begin;
+  stCoStat_t after;
+  co_get_stat(&after);
+  printf("%4ld KB frames [%s]: %8.1f ns/switch, copied %8.0f bytes/switch, remapped %llu\n", depth / 1024,
+         remap ? "remap" : "copy ", (double) cost / (loops * 2),
+         (double) (after.share_copy_bytes - before.share_copy_bytes) / (loops * 2),
+         after.share_remap_count - before.share_remap_count);
+
+  g_remap_stop = 1;
+  for (int i = 0; i < 2; i++) {
+    co_resume(co[i]);
+    co_release(co[i]);
+  }
+}
+
+static void BenchRemap(long depth_kb) {
+  long depths[] = {4, 16, 32, 64, 128, 256, 512};
+  int count = (int) (sizeof(depths) / sizeof(depths[0]));
+  if (depth_kb > 0) {
+    depths[0] = depth_kb;
+    count = 1;
+  }
+  for (int i = 0; i < count; i++) {
+    long loops = 4096 * 1024 / depths[i];
+    BenchRemapOne(depths[i] * 1024, loops, 0);
+    BenchRemapOne(depths[i] * 1024, loops, 1);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// hibernate：N 个挂起的长连接协程(栈上有一个4K的接收缓冲，只写了一小段请求头)，
+// co_eventloop 自动休眠前后每个协程的常驻内存，再全部唤醒检查栈内容
+
+static int g_hib_ticks;
+
+static void* HibernateRoutine(void* arg) {
+  char buf[4096];
+  memset(buf, 0, sizeof(buf));
+  int len = snprintf(buf, sizeof(buf), "GET /poll?id=%ld HTTP/1.1\r\nHost: example.com\r\nConnection: keep-alive\r\n\r\n",
+                     (long) arg);
+  __asm__ __volatile__("" : : "r"(buf) : "memory");
+  for (;;) {
+    co_yield_ct();
+    char expect[64];
+    snprintf(expect, sizeof(expect), "GET /poll?id=%ld ", (long) arg);
+    if (strncmp(buf, expect, strlen(expect)) || buf[len] || buf[sizeof(buf) - 1]) {
+      printf("hibernate: stack corrupted\n");
+      abort();
+    }
+  }
+  return NULL;
+}
+
+static int HibernateTick(void*) {
+  return ++g_hib_ticks > 20 ? -1 : 0;
+}
+
+static void BenchHibernate(int n, int flags, int share) {
+  stCoRoutineAttr_t attr;
+  if (share) {
+    attr.share_stack = co_alloc_sharestack(4, 128 * 1024);
+  }
+  stCoRoutine_t** cos = (stCoRoutine_t**) calloc(n, sizeof(stCoRoutine_t*));
+  long rss_begin = RssKB();
+  for (int i = 0; i < n; i++) {
+    co_create(&cos[i], &attr, HibernateRoutine, (void*) (long) i);
+    co_resume(cos[i]);
+  }
+  long rss_parked = RssKB();
+
+  co_set_hibernate(1, flags);
+  g_hib_ticks = 0;
+  co_eventloop(co_get_epoll_ct(), HibernateTick, NULL);
+  co_set_hibernate(0, 0);
+  long rss_hib = RssKB();
+  stCoStat_t st;
+  co_get_stat(&st);
+  printf("%d parked coroutines [%s%s]: %.2f KB/coroutine, hibernated %llu: %.2f KB/coroutine\n", n,
+         share ? "shared" : "private", (flags & CO_HIBERNATE_COMPRESS) ? " + lz" : "",
+         (double) (rss_parked - rss_begin) / n, st.hibernate_count, (double) (rss_hib - rss_begin) / n);
+  printf("  stack content %.0f bytes/coroutine, stored %.0f bytes/coroutine, slab %.0f bytes/coroutine\n",
+         (double) st.hibernate_raw_bytes / n, (double) st.hibernate_stored_bytes / n,
+         (double) st.hibernate_slab_bytes / n);
+
+  unsigned long long begin = NowNs();
+  for (int i = 0; i < n; i++) {
+    co_resume(cos[i]);
+  }
+  unsigned long long cost = NowNs() - begin;
+  co_get_stat(&st);
+  printf("  woke %llu: %.0f ns/resume, slab %llu bytes left\n", st.hibernate_wake, (double) cost / n,
+         st.hibernate_slab_bytes);
+  free(cos);
+}
+
+// ---------------------------------------------------------------------------
+// numa：工作线程里的协程栈和协程对象分布在哪些节点上。对照组的共享栈由主线程分配并弄脏
+
+struct stNumaBench_t {
+  int n;
+  int local;
+  stShareStack_t* share_stack; // 对照组：主线程分配的共享栈
+};
+
+static void* NumaWorker(void* arg) {
+  stNumaBench_t* bench = (stNumaBench_t*) arg;
+  co_set_numa_local(bench->local);
+  stCoRoutineAttr_t share_attr;
+  share_attr.share_stack = bench->share_stack ? bench->share_stack : co_alloc_sharestack(4, 128 * 1024);
+  for (int i = 0; i < bench->n; i++) {
+    stCoRoutine_t* co = NULL;
+    co_create(&co, i % 2 ? &share_attr : NULL, ShallowRoutine, NULL);
+    co_resume(co);
+  }
+
+  stCoNumaStat_t st;
+  if (co_get_numa_stat(&st) != 0) {
+    printf("numa [%s]: page placement not available (move_pages)\n", bench->local ? "local" : "default");
+    return NULL;
+  }
+  printf("numa [%s]: worker on node %d, %llu local pages, %llu remote pages\n", bench->local ? "local" : "default",
+         st.node, st.local_pages, st.remote_pages);
+  for (int i = 0; i < CO_NUMA_MAX_NODES; i++) {
+    if (st.stack_pages[i] || st.co_pages[i]) {
+      printf("  node %d: %llu stack pages, %llu coroutine object pages\n", i, st.stack_pages[i], st.co_pages[i]);
+    }
+  }
+  return NULL;
+}
+
+static void BenchNuma(int n) {
+  stNumaBench_t bench = {n, 0, co_alloc_sharestack(4, 128 * 1024)};
+  for (int i = 0; i < 4; i++) { // 主线程先弄脏(首次触碰)这些共享栈
+    stCoRoutineAttr_t attr;
+    attr.share_stack = bench.share_stack;
+    stCoRoutine_t* co = NULL;
+    co_create(&co, &attr, ShallowRoutine, NULL);
+    memset(co->stack_mem->stack_buffer, 0, co->stack_mem->stack_size);
+  }
+  pthread_t tid;
+  pthread_create(&tid, NULL, NumaWorker, &bench);
+  pthread_join(tid, NULL);
+
+  bench.local = 1;
+  bench.share_stack = NULL;
+  pthread_create(&tid, NULL, NumaWorker, &bench);
+  pthread_join(tid, NULL);
+}
+
+// ---------------------------------------------------------------------------
+// startup：像 example_echosvr 一样启动时创建 N 个协程并各 resume 一次(跑到第一次挂起)，统计就绪耗时
+
+static void BenchStartup(int n, int batch, int flags) {
+  stCoRoutine_t** cos = (stCoRoutine_t**) calloc(n, sizeof(stCoRoutine_t*));
+  co_get_epoll_ct(); // 线程环境先初始化好，不算进耗时
+  long rss_begin = RssKB();
+  unsigned long long begin = NowNs();
+  if (batch) {
+    co_create_batch(cos, n, NULL, ShallowRoutine, NULL, flags);
+  } else {
+    for (int i = 0; i < n; i++) {
+      co_create(&cos[i], NULL, ShallowRoutine, NULL);
+    }
+  }
+  unsigned long long created = NowNs();
+  for (int i = 0; i < n; i++) {
+    co_resume(cos[i]);
+  }
+  unsigned long long ready = NowNs();
+  printf("startup %d coroutines [%s]: create %.0f ns/co, ready %.0f ns/co (%.1f ms), %.1f KB/co\n", n,
+         !batch ? "co_create" : (flags & CO_BATCH_POPULATE) ? "batch + populate" : "batch",
+         (double) (created - begin) / n, (double) (ready - begin) / n, (ready - begin) / 1e6,
+         (double) (RssKB() - rss_begin) / n);
+  free(cos);
+}
+
+// ---------------------------------------------------------------------------
+// arena：共享栈上的请求处理协程，16K 临时缓冲区 + 16 个小对象放在栈上/malloc/co_arena_alloc
+
+enum {
+  kArenaStack = 0,
+  kArenaMalloc = 1,
+  kArenaArena = 2,
+};
+static int g_arena_mode;
+
+static void* ArenaRoutine(void*) {
+  char* buf;
+  if (g_arena_mode == kArenaStack) {
+    buf = (char*) alloca(16 * 1024);
+  } else if (g_arena_mode == kArenaMalloc) {
+    buf = (char*) malloc(16 * 1024);
+  } else {
+    buf = (char*) co_arena_alloc(16 * 1024);
+  }
+  memset(buf, 1, 512); // 一个小请求只用到开头
+  void* objs[16];
+  for (int i = 0; i < 16; i++) {
+    objs[i] = g_arena_mode == kArenaArena ? co_arena_alloc(64) : malloc(64);
+    memset(objs[i], i, 64);
+  }
+  co_yield_ct(); // 等后端回包
+  co_yield_ct();
+  for (int i = 0; g_arena_mode != kArenaArena && i < 16; i++) {
+    free(objs[i]);
+  }
+  if (g_arena_mode == kArenaMalloc) {
+    free(buf);
+  }
+  return NULL;
+}
+
+static void BenchArena(long n, int mode) {
+  g_arena_mode = mode;
+  stShareStack_t* share_stack = co_alloc_sharestack(1, 128 * 1024);
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share_stack;
+
+  const int kConcurrent = 8;
+  unsigned long long begin = NowNs();
+  for (long done = 0; done < n; done += kConcurrent) {
+    stCoRoutine_t* cos[kConcurrent];
+    for (int i = 0; i < kConcurrent; i++) {
+      co_create(&cos[i], &attr, ArenaRoutine, NULL);
+    }
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < kConcurrent; i++) {
+        co_resume(cos[i]);
+      }
+    }
+    for (int i = 0; i < kConcurrent; i++) {
+      co_release(cos[i]);
+    }
+  }
+  unsigned long long cost = NowNs() - begin;
+
+  stCoStat_t stat;
+  co_get_stat(&stat);
+  const char* names[] = {"stack", "malloc", "arena"};
+  printf("arena [%s]: %.0f ns/request, shared stack copy %llu bytes/request, arena chunks new %llu reused %llu\n",
+         names[mode], (double) cost / n, stat.share_copy_bytes / n, stat.arena_chunk_alloc, stat.arena_chunk_reuse);
+}
+
+// ---------------------------------------------------------------------------
+// allocs：阻塞路径(co_poll、co_cond_timedwait、hook 的 socket/close)每次操作的 malloc 次数。
+// 只在 example_bench_allocs 里计数：它用 -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc 链接，
+// 其他模式和 example_bench 本身都不经过计数
+
+static unsigned long long g_allocs;
+
+#if defined(__LIBCO_BENCH_COUNT_ALLOCS__)
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  g_allocs++;
+  return __real_malloc(size);
+}
+void* __wrap_calloc(size_t n, size_t size) {
+  g_allocs++;
+  return __real_calloc(n, size);
+}
+void* __wrap_realloc(void* p, size_t size) {
+  g_allocs++;
+  return __real_realloc(p, size);
+}
+}
+#endif
+
+struct stAllocsArg_t {
+  long n;
+  int warmup;
+  int nfds;
+  int fds[2];
+  stCoCond_t* cond[2];
+  int side;
+  int count;
+  int done;
+  unsigned long long before; // 计数区间两端的 g_allocs
+  unsigned long long after;
+};
+
+// 前 warmup 次不计数(线程的 slab 第一次补充对象)
+static void AllocsCount(stAllocsArg_t* arg, long i) {
+  if (i == arg->warmup) {
+    arg->before = g_allocs;
+  }
+}
+
+// 先跑完的协程结束计数区间
+static void AllocsDone(stAllocsArg_t* arg) {
+  if (!arg->done) {
+    arg->after = g_allocs;
+  }
+  arg->done++;
+}
+
+static void* AllocsPollRoutine(void* p) {
+  stAllocsArg_t* arg = (stAllocsArg_t*) p;
+  for (long i = 0; i < arg->warmup + arg->n; i++) {
+    AllocsCount(arg, i);
+    struct pollfd pfd[2];
+    for (int k = 0; k < arg->nfds; k++) {
+      pfd[k].fd = arg->fds[k];
+      pfd[k].events = POLLIN;
+      pfd[k].revents = 0;
+    }
+    co_poll(co_get_epoll_ct(), pfd, arg->nfds, 1000); // fds[0] 一直可读，每次都要经过 co_eventloop 唤醒
+  }
+  AllocsDone(arg);
+  return NULL;
+}
+
+static void* AllocsCondRoutine(void* p) {
+  stAllocsArg_t* arg = (stAllocsArg_t*) p;
+  int side = arg->side++;
+  for (long i = 0; i < arg->warmup + arg->n; i++) {
+    if (side == 0) { // 先运行的一方先等，另一方的信号才不会丢
+      co_cond_timedwait(arg->cond[1], -1);
+      co_cond_signal(arg->cond[0]);
+    } else {
+      AllocsCount(arg, i);
+      co_cond_signal(arg->cond[1]);
+      co_cond_timedwait(arg->cond[0], -1);
+    }
+  }
+  AllocsDone(arg);
+  return NULL;
+}
+
+static void* AllocsSocketRoutine(void* p) {
+  co_enable_hook_sys();
+  stAllocsArg_t* arg = (stAllocsArg_t*) p;
+  for (long i = 0; i < arg->warmup + arg->n; i++) {
+    AllocsCount(arg, i);
+    close(socket(AF_INET, SOCK_STREAM, 0));
+  }
+  AllocsDone(arg);
+  return NULL;
+}
+
+static int AllocsStop(void* p) {
+  stAllocsArg_t* arg = (stAllocsArg_t*) p;
+  return arg->done == arg->count ? -1 : 0;
+}
+
+static void BenchAllocsOne(const char* name, long n, int nfds, int share, pfn_co_routine_t routine, int count) {
+  stAllocsArg_t arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.n = n;
+  arg.warmup = 100;
+  arg.nfds = nfds;
+  arg.count = count;
+  socketpair(AF_UNIX, SOCK_STREAM, 0, arg.fds);
+  write(arg.fds[1], "x", 1);
+  if (nfds == 2) { // 第二个 fd 也要在 poll 里登记：再开一对，保持不可读
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    arg.fds[1] = pair[0];
+  }
+  arg.cond[0] = co_cond_alloc();
+  arg.cond[1] = co_cond_alloc();
+
+  stCoRoutineAttr_t attr;
+  attr.share_stack = share ? co_alloc_sharestack(1, 128 * 1024) : NULL;
+  unsigned long long begin = NowNs();
+  for (int i = 0; i < count; i++) {
+    stCoRoutine_t* co = NULL;
+    co_create(&co, &attr, routine, &arg);
+    co_resume(co);
+  }
+  co_eventloop(co_get_epoll_ct(), AllocsStop, &arg);
+  unsigned long long cost = NowNs() - begin;
+#if defined(__LIBCO_BENCH_COUNT_ALLOCS__)
+  printf("allocs [%s]: mallocs %llu -> %llu, %.3f mallocs/op, %.0f ns/op\n", name, arg.before, arg.after,
+         (double) (arg.after - arg.before) / n, (double) cost / n);
+#else
+  printf("allocs [%s]: %.0f ns/op\n", name, (double) cost / n);
+#endif
+  co_cond_free(arg.cond[0]);
+  co_cond_free(arg.cond[1]);
+}
+
+static void BenchAllocs(long n) {
+#if !defined(__LIBCO_BENCH_COUNT_ALLOCS__)
+  printf("allocs: mallocs are not counted here, run example_bench_allocs allocs\n");
+#endif
+  BenchAllocsOne("co_poll 1 fd", n, 1, 0, AllocsPollRoutine, 1);
+  BenchAllocsOne("co_poll 2 fds, shared stack", n, 2, 1, AllocsPollRoutine, 1);
+  BenchAllocsOne("co_cond signal + wait round trip", n, 0, 0, AllocsCondRoutine, 2);
+  BenchAllocsOne("socket + close", n, 0, 0, AllocsSocketRoutine, 1);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage:\n"
+           "example_bench switch [LOOPS]\n"
+           "example_bench transfer [LOOPS]\n"
+           "example_bench sharestack [LOOPS]\n"
+           "example_bench rss [N] [mmap]\n"
+           "example_bench churn [N] [pool] [reuse|inplace] [mmap]\n"
+           "example_bench tlb [STACKS] [hugepage]\n"
+           "example_bench assign [rr|occupied|recent|rebalance] [promote]\n"
+           "example_bench eventloop [group]\n"
+           "example_bench idle [N] [free]\n"
+           "example_bench stackprof\n"
+           "example_bench grow [N] [overflow]\n"
+           "example_bench remap [DEPTH_KB]\n"
+           "example_bench hibernate [N] [lz] [share]\n"
+           "example_bench numa [N]\n"
+           "example_bench startup [N] [batch] [populate]\n"
+           "example_bench arena [N] [stack|malloc]\n"
+           "example_bench allocs [N]\n");
+    return -1;
+  }
+  const char* mode = argv[1];
+  long loops = argc > 2 ? atol(argv[2]) : 10000000;
+
+  if (!strcmp(mode, "switch")) {
+    BenchSwitch(loops);
+  } else if (!strcmp(mode, "transfer")) {
+    BenchTransfer(loops);
+  } else if (!strcmp(mode, "sharestack")) {
+    BenchShareStack(loops);
+  } else if (!strcmp(mode, "churn")) {
+    int pool = 0;
+    int reuse = 0;
+    int stack_flags = 0;
+    for (int i = 3; i < argc; i++) {
+      pool |= !strcmp(argv[i], "pool");
+      reuse = !strcmp(argv[i], "reuse") ? 1 : !strcmp(argv[i], "inplace") ? 2 : reuse;
+      stack_flags |= !strcmp(argv[i], "mmap") ? CO_STACK_MMAP : 0;
+    }
+    BenchChurn(argc > 2 ? loops : 1000000, pool, reuse, stack_flags);
+  } else if (!strcmp(mode, "tlb")) {
+    int stacks = argc > 2 ? atoi(argv[2]) : 64;
+    int flags = argc > 3 && !strcmp(argv[3], "hugepage") ? CO_STACK_HUGEPAGE : 0;
+    BenchTlb(stacks, 2000000, flags);
+  } else if (!strcmp(mode, "assign")) {
+    const char* policies[] = {"rr", "occupied", "recent", "rebalance"};
+    int policy = CO_SHARE_ROUND_ROBIN;
+    for (int i = 0; argc > 2 && i < 4; i++) {
+      if (!strcmp(argv[2], policies[i])) {
+        policy = i;
+      }
+    }
+    BenchAssign(1000000, policy, argc > 3 && !strcmp(argv[3], "promote"));
+  } else if (!strcmp(mode, "eventloop")) {
+    BenchEventLoop(argc > 2 && !strcmp(argv[2], "group"));
+  } else if (!strcmp(mode, "idle")) {
+    BenchIdle(argc > 2 ? loops : 1000, argc > 3 && !strcmp(argv[3], "free") ? MADV_FREE : MADV_DONTNEED);
+  } else if (!strcmp(mode, "stackprof")) {
+    BenchStackProfile();
+  } else if (!strcmp(mode, "grow")) {
+    BenchGrow(argc > 2 ? loops : 1000, argc > 3 && !strcmp(argv[3], "overflow"));
+  } else if (!strcmp(mode, "remap")) {
+    BenchRemap(argc > 2 ? loops : 0);
+  } else if (!strcmp(mode, "hibernate")) {
+    int flags = 0;
+    int share = 0;
+    for (int i = 3; i < argc; i++) {
+      flags |= !strcmp(argv[i], "lz") ? CO_HIBERNATE_COMPRESS : 0;
+      share |= !strcmp(argv[i], "share");
+    }
+    BenchHibernate(argc > 2 ? loops : 10000, flags, share);
+  } else if (!strcmp(mode, "numa")) {
+    BenchNuma(argc > 2 ? loops : 1000);
+  } else if (!strcmp(mode, "startup")) {
+    int batch = 0;
+    int flags = 0;
+    for (int i = 3; i < argc; i++) {
+      batch |= !strcmp(argv[i], "batch");
+      flags |= !strcmp(argv[i], "populate") ? CO_BATCH_POPULATE : 0;
+    }
+    BenchStartup(argc > 2 ? loops : 50000, batch, flags);
+  } else if (!strcmp(mode, "arena")) {
+    int arena_mode = kArenaArena;
+    if (argc > 3) {
+      arena_mode = !strcmp(argv[3], "stack") ? kArenaStack : !strcmp(argv[3], "malloc") ? kArenaMalloc : kArenaArena;
+    }
+    BenchArena(argc > 2 ? loops : 200000, arena_mode);
+  } else if (!strcmp(mode, "allocs")) {
+    BenchAllocs(argc > 2 ? loops : 100000);
+  } else if (!strcmp(mode, "rss")) {
+    BenchRss(argc > 2 ? loops : 10000, argc > 3 && !strcmp(argv[3], "mmap") ? CO_STACK_MMAP : 0);
+  } else {
+    printf("unknown mode %s\n", mode);
+    return -1;
+  }
+  return 0;
+}
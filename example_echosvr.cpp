@@ -63,7 +63,8 @@ static void* readwrite_routine(void* arg) {
   co_enable_hook_sys();
 
   task_t* co = (task_t*) arg;
-  char buf[1024 * 16];
+  const int buf_size = 1024 * 16;
+  char* buf = (char*) co_arena_alloc(buf_size); // 不占协程栈，协程结束时随区域一起释放
   for (;;) {
     if (-1 == co->fd) {
       g_readwrite.push(co);
@@ -80,7 +81,7 @@ static void* readwrite_routine(void* arg) {
       pf.events = (POLLIN | POLLERR | POLLHUP);
       co_poll(co_get_epoll_ct(), &pf, 1, 1000);
 
-      int ret = read(fd, buf, sizeof(buf));
+      int ret = read(fd, buf, buf_size);
       if (ret > 0) {
         ret = write(fd, buf, ret);
       }